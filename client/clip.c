@@ -16,11 +16,13 @@ int main(int argc, char **argv) {
 	VGint x, cx, cy, cw, ch, midy, speed;
 	char *message = "一只敏捷的棕色狐狸跳过了一只懒惰的狗";
 	char done[3];
+	Ticker msg;
 
 	init(&w, &h);
 	speed = 2;
 	midy = (VGfloat) h / 2;
 	fontsize = w / 50;
+	msg = NewTicker(message, fontsize);		   // rendered once, then moved
 	cx = 0.0;
 	ch = fontsize * 2;
 	cw = w;
@@ -32,14 +34,12 @@ int main(int argc, char **argv) {
 		Background(255, 255, 255);
 		Fill(0,0,0,.2);
 		Rect(cx, cy, cw, ch);
-		ClipRect(cx, cy, cw, ch);
-		Translate(x, cy + (fontsize / 2));
 		Fill(0, 0, 0, 1);
-		Text(0, 0, message, fontsize);
-		ClipEnd();
+		TickerDraw(msg, cx, cy + (fontsize / 2), cw, x);
 		End();
 	}
 	fgets(done, 2, stdin); // press [Return] when done
+	DeleteTicker(msg);
 	finish();
 	exit(0);
 }
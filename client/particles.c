@@ -20,8 +20,8 @@
 #include "VG/vgu.h"
 #include "shapes.h"
 
-// ~55 seems to be the limit before jankiness kicks in
-#define NUM_PARTICLES 50
+// particles are drawn in one batch per color, so thousands of them keep up
+#define NUM_PARTICLES 2000
 
 typedef struct particle {
 	int x, y;
@@ -32,6 +32,9 @@ typedef struct particle {
 
 particle_t particles[NUM_PARTICLES];
 
+// positions, sizes and colors for CirclesColor
+VGfloat px[NUM_PARTICLES], py[NUM_PARTICLES], pr[NUM_PARTICLES], pc[NUM_PARTICLES * 4];
+
 int showTrails = 0;
 int directionRTL = 0;
 int alternate = 1;
@@ -47,10 +50,12 @@ void initParticles(int w, int h) {
 		p->y = 0;
 		p->vx = (rand() % 30) + 30;
 		p->vy = (rand() % 20) + 40;
-		p->r = rand() % 256;
-		p->g = rand() % 256;
-		p->b = rand() % 256;
+		// 4 levels per channel, so the particles share 64 colors
+		p->r = (rand() % 4) * 85;
+		p->g = (rand() % 4) * 85;
+		p->b = (rand() % 4) * 85;
 		p->radius = (rand() % 20) + 20;
+		RGBA(p->r, p->g, p->b, 1.0, &pc[i * 4]);
 
 		if (directionRTL) {
 			p->vx *= -1;
@@ -75,9 +80,14 @@ void draw(int w, int h) {
 
 	for (i = 0; i < NUM_PARTICLES; i++) {
 		p = &particles[i];
+		px[i] = p->x;
+		py[i] = p->y;
+		pr[i] = p->radius;
+	}
+	CirclesColor(px, py, pr, pc, NUM_PARTICLES);
 
-		Fill(p->r, p->g, p->b, 1.0);
-		Circle(p->x, p->y, p->radius);
+	for (i = 0; i < NUM_PARTICLES; i++) {
+		p = &particles[i];
 
 		// Apply the velocity
 		p->x += p->vx;
@@ -7,6 +7,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <math.h>
+#include <time.h>
 #include "VG/openvg.h"
 #include "VG/vgu.h"
 #include "shapes.h"
@@ -31,15 +33,24 @@ void coordpoint(VGfloat x, VGfloat y, VGfloat size, VGfloat pcolor[4]) {
 // grid draws a grid
 void grid(VGfloat x, VGfloat y, int n, int w, int h) {
 	VGfloat ix, iy;
-	Stroke(128, 128, 128, 0.5);
-	StrokeWidth(2);
-	for (ix = x; ix <= x + w; ix += n) {
-		Line(ix, y, ix, y + h);
+	int nl = 0, max = (w / n) + (h / n) + 2;
+	VGfloat *x1 = malloc(max * 4 * sizeof(VGfloat));
+	VGfloat *y1 = x1 + max, *x2 = y1 + max, *y2 = x2 + max;
+
+	for (ix = x; ix <= x + w && nl < max; ix += n, nl++) {
+		x1[nl] = x2[nl] = ix;
+		y1[nl] = y;
+		y2[nl] = y + h;
 	}
-
-	for (iy = y; iy <= y + h; iy += n) {
-		Line(x, iy, x + w, iy);
+	for (iy = y; iy <= y + h && nl < max; iy += n, nl++) {
+		x1[nl] = x;
+		x2[nl] = x + w;
+		y1[nl] = y2[nl] = iy;
 	}
+	Stroke(128, 128, 128, 0.5);
+	StrokeWidth(2);
+	Lines(x1, y1, x2, y2, nl);
+	free(x1);
 }
 // gradient demos linear and radial gradients
 void gradient(int width, int height) {
@@ -162,17 +173,23 @@ typedef struct {
 	int fontsize;
 } FW;
 
-void textbbox(char *s, int pointsize) {
-
+// textbbox outlines the ink bounding box of text drawn at (x,y)
+void textbbox(VGfloat x, VGfloat y, char *s, int pointsize) {
+	VGfloat box[4];
+	TextBBox(s, pointsize, box);
+	Fill(0, 0, 0, 0);
+	Stroke(128, 0, 0, 0.5);
+	StrokeWidth(1);
+	Rect(x + box[0], y + box[1], box[2], box[3]);
 }
 
 // adjust the font to fit within a width
-void fitwidth(int width, int adj, char *s, FW * f) {
-	f->tw = TextWidth(s, f->fontsize);
-	while (f->tw > width) {
-		f->fontsize -= adj;
-		f->tw = TextWidth(s, f->fontsize);
+void fitwidth(int width, char *s, FW * f) {
+	int fit = TextFit(s, width, 0);
+	if (fit < f->fontsize) {
+		f->fontsize = fit;
 	}
+	f->tw = TextWidth(s, f->fontsize);
 }
 
 // testpattern shows a test pattern 
@@ -196,9 +213,9 @@ void testpattern(int w, int h, char *s) {
 	Rect(w - 100, h - 100, 100, 100);
 
 	// for each font, (Sans, Serif, Mono), adjust the string to the w
-	fitwidth(w, 20, s, &tw1);
-	fitwidth(w, 20, s, &tw2);
-	fitwidth(w, 20, s, &tw3);
+	fitwidth(w, s, &tw1);
+	fitwidth(w, s, &tw2);
+	fitwidth(w, s, &tw3);
 
 	midx = w / 2;
 
@@ -213,6 +230,12 @@ void testpattern(int w, int h, char *s) {
 	TextMid(midx, midy2, s, tw2.fontsize);
 	Fill(0, 0, 128, 1);
 	TextMid(midx, midy3, s, tw3.fontsize);
+
+	// outline the ink boxes, as a check on TextBBox
+	textbbox(midx - tw1.tw / 2, midy1, s, tw1.fontsize);
+	textbbox(midx - tw2.tw / 2, midy2, s, tw2.fontsize);
+	textbbox(midx - tw3.tw / 2, midy3, s, tw3.fontsize);
+	StrokeWidth(0);
 	End();
 }
 
@@ -491,6 +514,7 @@ void rshapes(int width, int height, int n) {
 	VGfloat sx, sy, cx, cy, px, py, ex, ey, pox, poy;
 	VGfloat polyx[np], polyy[np];
 	rseed();
+	DeferDraw(1);
 	Start(width, height);
 	for (i = 0; i < n; i++) {
 		Fill(randcolor(), randcolor(), randcolor(), drand48());
@@ -543,6 +567,78 @@ void rshapes(int width, int height, int n) {
 	Fill(128, 0, 0, 1);
 	Text(20, 20, "OpenVG on the Raspberry Pi", 32);
 	End();
+	DeferDraw(0);
+}
+
+// seconds returns a monotonic time in seconds
+double seconds() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (t.tv_nsec / 1e9);
+}
+
+// instances draws n colored, rotated markers for a number of frames, first one
+// at a time and then with DrawInstances, and shows the time taken by each
+void instances(int w, int h, int n) {
+	int i, f, frames = 60;
+	VGfloat *x = malloc(n * sizeof(VGfloat)), *y = malloc(n * sizeof(VGfloat)), *a = malloc(n * sizeof(VGfloat));
+	VGfloat *m = malloc(n * 9 * sizeof(VGfloat)), *c = malloc(n * 4 * sizeof(VGfloat));
+	double t0, loop, inst;
+	char msg[100];
+	Path p = NewPath();
+
+	PathMoveTo(p, -10, -6);
+	PathLineTo(p, 12, 0);
+	PathLineTo(p, -10, 6);
+	PathLineTo(p, -5, 0);
+	PathClose(p);
+	for (i = 0; i < n; i++) {
+		x[i] = randf(w);
+		y[i] = randf(h);
+		a[i] = randf(360);
+		RGBA((i % 8) * 32, 255 - (i % 8) * 32, 128, 1, c + (4 * i));
+	}
+
+	t0 = seconds();
+	for (f = 0; f < frames; f++) {
+		Start(w, h);
+		Background(0, 0, 0);
+		for (i = 0; i < n; i++) {
+			Push();
+			Translate(x[i], y[i]);
+			Rotate(a[i] + f);
+			setfill(c + (4 * i));
+			DrawPath(p, VG_FILL_PATH);
+			Pop();
+		}
+		End();
+	}
+	loop = (seconds() - t0) / frames;
+
+	t0 = seconds();
+	for (f = 0; f < frames; f++) {
+		Start(w, h);
+		Background(0, 0, 0);
+		for (i = 0; i < n; i++) {
+			VGfloat r = (a[i] + f) * M_PI / 180, cs = cos(r), sn = sin(r);
+			VGfloat mi[9] = { cs, sn, 0, -sn, cs, 0, x[i], y[i], 1 };
+			memcpy(m + (9 * i), mi, sizeof(mi));
+		}
+		DrawInstances(p, m, c, n, VG_FILL_PATH);
+		End();
+	}
+	inst = (seconds() - t0) / frames;
+
+	Fill(255, 255, 255, 1);
+	sprintf(msg, "%d markers: %.2f ms a frame one at a time, %.2f ms instanced", n, loop * 1000, inst * 1000);
+	TextMid(w / 2, h / 2, msg, w / 60);
+	End();
+	DeletePath(p);
+	free(x);
+	free(y);
+	free(a);
+	free(m);
+	free(c);
 }
 
 // sunearth shows the relative sizes of the sun and the earth
@@ -630,7 +726,7 @@ void waituntil(int endchar) {
 int main(int argc, char **argv) {
 	int w, h, n;
 	char *usage =
-	    "%s [command]\n\tdemo sec\n\tastro\n\ttest ...\n\trand n\n\trotate n ...\n\timage\n\ttext\n\tfontsize\n\traspi\n\tadvert\n\tgradient\n";
+	    "%s [command]\n\tdemo sec\n\tastro\n\ttest ...\n\trand n\n\tinstances n\n\trotate n ...\n\timage\n\ttext\n\tfontsize\n\traspi\n\tadvert\n\tgradient\n";
 	char *progname = argv[0];
 	saveterm();
 	init(&w, &h);
@@ -671,6 +767,11 @@ int main(int argc, char **argv) {
 			rshapes(w, h, n);
 		} else if (strncmp(argv[1], "test", 4) == 0) {
 			testpattern(w, h, argv[2]);
+		} else if (strncmp(argv[1], "instances", 9) == 0) {
+			if (n < 1 || n > 100000) {
+				n = 1000;
+			}
+			instances(w, h, n);
 		} else {
 			restoreterm();
 			fprintf(stderr, usage, progname);
@@ -6,6 +6,7 @@ typedef struct {
 
 	EGLSurface surface;
 	EGLContext context;
+	EGLConfig config;					   // also used for offscreen image surfaces
 } STATE_T;
 
 extern void oglinit(STATE_T *);
@@ -0,0 +1,290 @@
+//
+// font2vgf: convert a TrueType font into a libshapes outline bundle
+//
+// Usage: font2vgf [-s textfile]... [-c codepoints] font.ttf out.vgf
+//
+// Options:
+//  -s  keep only the codepoints used in this UTF-8 text file (repeatable)
+//  -c  keep only the codepoints in this UTF-8 string
+//
+// Without -s or -c every codepoint in the font's charmap is converted.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ft2build.h"
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+#include "vgfont.h"
+
+// outline accumulates the converted segments and coordinates of all glyphs
+typedef struct {
+	uint8_t *segs;
+	int32_t *coords;
+	uint32_t nseg, ncoord;
+	uint32_t segcap, coordcap;
+	int open;
+} outline;
+
+static outline out;
+
+// reserve makes room for nseg more segments and ncoord more coordinates
+void reserve(outline * o, uint32_t nseg, uint32_t ncoord) {
+	if (o->nseg + nseg > o->segcap) {
+		o->segcap = (o->nseg + nseg) * 2;
+		o->segs = realloc(o->segs, o->segcap);
+	}
+	if (o->ncoord + ncoord > o->coordcap) {
+		o->coordcap = (o->ncoord + ncoord) * 2;
+		o->coords = realloc(o->coords, o->coordcap * sizeof(int32_t));
+	}
+	if (o->segs == NULL || o->coords == NULL) {
+		fprintf(stderr, "font2vgf: out of memory\n");
+		exit(1);
+	}
+}
+
+// segment appends a path segment with n points, scaled as libshapes does
+void segment(outline * o, uint8_t seg, const FT_Vector * p, int n) {
+	reserve(o, 1, n * 2);
+	o->segs[o->nseg++] = seg;
+	for (int i = 0; i < n; i++) {
+		o->coords[o->ncoord++] = p[i].x * 16;
+		o->coords[o->ncoord++] = p[i].y * 16;
+	}
+}
+
+// closepath closes the open subpath, if any
+void closepath(outline * o) {
+	if (o->open) {
+		reserve(o, 1, 0);
+		o->segs[o->nseg++] = 0;			   // VG_CLOSE_PATH
+		o->open = 0;
+	}
+}
+
+int moveto(const FT_Vector * to, void *user) {
+	closepath(user);
+	segment(user, 2, to, 1);			   // VG_MOVE_TO_ABS
+	((outline *) user)->open = 1;
+	return 0;
+}
+
+int lineto(const FT_Vector * to, void *user) {
+	segment(user, 4, to, 1);			   // VG_LINE_TO_ABS
+	return 0;
+}
+
+int conicto(const FT_Vector * control, const FT_Vector * to, void *user) {
+	FT_Vector p[2] = { *control, *to };
+	segment(user, 10, p, 2);			   // VG_QUAD_TO_ABS
+	return 0;
+}
+
+int cubicto(const FT_Vector * c1, const FT_Vector * c2, const FT_Vector * to, void *user) {
+	FT_Vector p[3] = { *c1, *c2, *to };
+	segment(user, 12, p, 3);			   // VG_CUBIC_TO_ABS
+	return 0;
+}
+
+static const FT_Outline_Funcs funcs = { moveto, lineto, conicto, cubicto, 0, 0 };
+
+// codepoint set, as a bitmap over the Unicode range
+#define MAXCODE 0x110000
+static uint8_t wanted[MAXCODE / 8];
+static int subset = 0;
+
+// want marks a codepoint as used
+void want(uint32_t c) {
+	if (c < MAXCODE) {
+		wanted[c >> 3] |= 1 << (c & 7);
+	}
+}
+
+// wantstring marks every codepoint of a UTF-8 string. It decodes as libshapes
+// does: overlong forms, surrogates and values past U+10FFFF are malformed, and
+// a malformed sequence skips one byte.
+void wantstring(const unsigned char *s, size_t n) {
+	size_t i = 0;
+	while (i < n) {
+		uint32_t uc = s[i];
+		unsigned char lo = 0x80, hi = 0xBF;		   // allowed range of the second byte
+		int len, k;
+		if (uc < 0x80) {
+			want(uc);
+			i++;
+			continue;
+		} else if (uc >= 0xC2 && uc <= 0xDF) {
+			uc &= 0x1F, len = 2;
+		} else if (uc >= 0xE0 && uc <= 0xEF) {
+			if (uc == 0xE0)
+				lo = 0xA0;			   // overlong
+			else if (uc == 0xED)
+				hi = 0x9F;			   // surrogates
+			uc &= 0x0F, len = 3;
+		} else if (uc >= 0xF0 && uc <= 0xF4) {
+			if (uc == 0xF0)
+				lo = 0x90;			   // overlong
+			else if (uc == 0xF4)
+				hi = 0x8F;			   // past U+10FFFF
+			uc &= 0x07, len = 4;
+		} else {
+			i++;
+			continue;
+		}
+		for (k = 1; k < len && i + k < n; k++) {
+			unsigned char b = s[i + k];
+			if (k == 1 ? (b < lo || b > hi) : (b & 0xC0) != 0x80) {
+				break;
+			}
+			uc = (uc << 6) | (b & 0x3F);
+		}
+		if (k < len) {
+			i++;
+			continue;
+		}
+		want(uc);
+		i += len;
+	}
+}
+
+// wantfile marks every codepoint used in a UTF-8 text file
+void wantfile(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		perror(filename);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	long n = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	unsigned char *buf = malloc(n > 0 ? n : 1);
+	if (buf == NULL || fread(buf, 1, n, fp) != (size_t) n) {
+		fprintf(stderr, "font2vgf: cannot read %s\n", filename);
+		exit(1);
+	}
+	wantstring(buf, n);
+	free(buf);
+	fclose(fp);
+}
+
+// addglyph converts one glyph into the bundle tables
+void addglyph(FT_Face face, uint32_t codepoint, FT_UInt index, vgfglyph * g) {
+	FT_BBox box;
+
+	if (FT_Load_Glyph(face, index, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM) != 0) {
+		fprintf(stderr, "font2vgf: cannot load glyph %u for U+%04X\n", index, codepoint);
+		exit(1);
+	}
+	FT_Outline *o = &face->glyph->outline;
+	FT_Outline_Get_CBox(o, &box);
+
+	memset(g, 0, sizeof(*g));
+	g->codepoint = codepoint;
+	g->advance = face->glyph->advance.x * 16;
+	g->minx = box.xMin * 16;
+	g->miny = box.yMin * 16;
+	g->maxx = box.xMax * 16;
+	g->maxy = box.yMax * 16;
+	g->seg = out.nseg;
+	g->coord = out.ncoord;
+	FT_Outline_Decompose(o, &funcs, &out);
+	closepath(&out);
+	g->nseg = out.nseg - g->seg;
+	g->ncoord = out.ncoord - g->coord;
+}
+
+// usage prints the command line and exits
+void usage(char *progname) {
+	fprintf(stderr, "usage: %s [-s textfile]... [-c codepoints] font.ttf out.vgf\n", progname);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	FT_Library library;
+	FT_Face face;
+	FT_UInt index;
+	FT_ULong c;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			wantfile(argv[++i]);
+			subset = 1;
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			i++;
+			wantstring((unsigned char *)argv[i], strlen(argv[i]));
+			subset = 1;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (argc - i != 2) {
+		usage(argv[0]);
+	}
+
+	if (FT_Init_FreeType(&library) != 0 || FT_New_Face(library, argv[i], 0, &face) != 0) {
+		fprintf(stderr, "font2vgf: cannot open %s\n", argv[i]);
+		return 1;
+	}
+	// the same nominal size libshapes uses for outlines
+	FT_Set_Char_Size(face, 0, 64 * 64, 96, 96);
+
+	// count the glyphs: the missing glyph plus every mapped, wanted codepoint
+	uint32_t n = 1;
+	for (c = FT_Get_First_Char(face, &index); index != 0; c = FT_Get_Next_Char(face, c, &index)) {
+		if (!subset || (c < MAXCODE && (wanted[c >> 3] & (1 << (c & 7))))) {
+			n++;
+		}
+	}
+	vgfglyph *glyphs = calloc(n, sizeof(vgfglyph));
+	if (glyphs == NULL) {
+		fprintf(stderr, "font2vgf: out of memory\n");
+		return 1;
+	}
+
+	// the charmap is walked in codepoint order, so the table comes out sorted
+	uint32_t ng = 0;
+	addglyph(face, 0, 0, &glyphs[ng++]);
+	for (c = FT_Get_First_Char(face, &index); index != 0; c = FT_Get_Next_Char(face, c, &index)) {
+		if (c != 0 && (!subset || (c < MAXCODE && (wanted[c >> 3] & (1 << (c & 7)))))) {
+			addglyph(face, c, index, &glyphs[ng++]);
+		}
+	}
+
+	vgfheader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = VGF_MAGIC;
+	hdr.version = VGF_VERSION;
+	hdr.nglyphs = ng;
+	hdr.nsegs = out.nseg;
+	hdr.ncoords = out.ncoord;
+	hdr.ascender = face->size->metrics.ascender * 16;
+	hdr.descender = face->size->metrics.descender * 16;
+	hdr.height = face->size->metrics.height * 16;
+	hdr.glyphoffset = sizeof(hdr);
+	hdr.segoffset = hdr.glyphoffset + ng * sizeof(vgfglyph);
+	hdr.coordoffset = (hdr.segoffset + out.nseg + 3) & ~3u;
+
+	FILE *fp = fopen(argv[i + 1], "wb");
+	if (fp == NULL) {
+		perror(argv[i + 1]);
+		return 1;
+	}
+	static const uint8_t pad[4];
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(glyphs, sizeof(vgfglyph), ng, fp);
+	fwrite(out.segs, 1, out.nseg, fp);
+	fwrite(pad, 1, hdr.coordoffset - (hdr.segoffset + out.nseg), fp);
+	fwrite(out.coords, sizeof(int32_t), out.ncoord, fp);
+	if (fclose(fp) != 0) {
+		perror(argv[i + 1]);
+		return 1;
+	}
+	fprintf(stderr, "%s: %u glyphs, %u segments, %u coordinates\n", argv[i + 1], ng, out.nseg, out.ncoord);
+
+	free(glyphs);
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+	return 0;
+}
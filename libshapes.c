@@ -4,26 +4,57 @@
 //
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
 #include <termios.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
 #include <assert.h>
 #include <jpeglib.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "VG/openvg.h"
 #include "VG/vgu.h"
 #include "EGL/egl.h"
 #include "GLES/gl.h"
 #include "bcm_host.h"
+#include "shapes.h"
 #include "eglstate.h"					   // data structures for graphics state
+#include "vgfont.h"					   // font bundle layout
 #include "ft2build.h"
 #include FT_FREETYPE_H
 #include FT_OUTLINE_H
 
 #define FONTLIB	"/usr/share/fonts/TTF/HanaMinA.ttf"
+#define FONTBUNDLE	"/usr/share/fonts/TTF/HanaMinA.vgf"	   // made by fontutil/font2vgf, used instead of FONTLIB when present
 
 FT_Library library;
-FT_Face face;
 
 static STATE_T _state, *state = &_state;	// global graphics state
+static StartupStats startup;
 static const int MAXFONTPATH = 0xA000;
+static void unloadfonts();
+static void mergeflush();
+static void atlasflush();
+static void stopworker();
+static void paintflush();
+static void gradientflush();
+static void fontpoll();
+static void warmdrain(int budget);
+static void fontwait(int id);
+static void startupmark(double *t);
+static void deferflush();
+static void paintsync();
+static void shapeflush();
+static int screenculled(VGfloat x, VGfloat y, VGfloat w, VGfloat h);
 //
 // Terminal settings
 //
@@ -150,17 +181,25 @@ VGImage createImageFromJpeg(const char *filename) {
 
 // makeimage makes an image from a raw raster of red, green, blue, alpha values
 void makeimage(VGfloat x, VGfloat y, int w, int h, VGubyte * data) {
+	if (screenculled(x, y, w, h)) {
+		return;
+	}
 	unsigned int dstride = w * 4;
 	VGImageFormat rgbaFormat = VG_sABGR_8888;
 	VGImage img = vgCreateImage(rgbaFormat, w, h, VG_IMAGE_QUALITY_BETTER);
 	vgImageSubData(img, (void *)data, dstride, rgbaFormat, 0, 0, w, h);
+	deferflush();
 	vgSetPixels(x, y, img, 0, 0, w, h);
 	vgDestroyImage(img);
 }
 
 // Image places an image at the specifed location
 void Image(VGfloat x, VGfloat y, int w, int h, char *filename) {
+	if (screenculled(x, y, w, h)) {
+		return;
+	}
 	VGImage img = createImageFromJpeg(filename);
+	deferflush();
 	vgSetPixels(x, y, img, 0, 0, w, h);
 	vgDestroyImage(img);
 }
@@ -175,93 +214,597 @@ void dumpscreen(int w, int h, FILE * fp) {
 
 // init sets the system to its initial state
 void init(int *w, int *h) {
+	startupmark(NULL);
 	bcm_host_init();
 	memset(state, 0, sizeof(*state));
 	oglinit(state);
 	*w = state->screen_width;
 	*h = state->screen_height;
-	int error;
-
-	error = FT_Init_FreeType(&library);
-	if (error) {
-		printf("error!\n");
-		exit(-1);
-	}
 
-	error = FT_New_Face(library, FONTLIB, 0, &face);
-	if (error == FT_Err_Unknown_File_Format) {
-		printf("unsupport!\n");
-		exit(-1);
-	} else if (error) {
+	// a precompiled bundle needs no FreeType at all; otherwise the font loads
+	// in the background and the first text drawn waits for it
+	if (LoadFontBundle(FONTBUNDLE) < 0 && LoadFontAsync(FONTLIB) < 0) {
 		printf("error!\n");
 		exit(-1);
 	}
-	FT_Set_Char_Size(face, 0, 64 * 64, 96, 96);
+	startupmark(&startup.init);
 }
 
 // finish cleans up
 void finish() {
+	DeferDraw(0);
+	stopworker();
+	mergeflush();
+	atlasflush();
+	GlyphCacheFlush();
+	paintflush();
+	shapeflush();
+	ResetState();
 	glClear(GL_COLOR_BUFFER_BIT);
 	eglSwapBuffers(state->display, state->surface);
 	eglMakeCurrent(state->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 	eglDestroySurface(state->display, state->surface);
 	eglDestroyContext(state->display, state->context);
 	eglTerminate(state->display);
-	FT_Done_Face(face);
-	FT_Done_FreeType(library);
+	unloadfonts();
+}
+
+//
+// State shadowing
+//
+
+#define SHADOWMAX	32					   // parameters shadowed
+#define SHADOWVEC	8					   // longest vector shadowed; longer ones are always set
+
+// shadowparam is the value last set for a VG parameter, kept as raw 32-bit words
+typedef struct {
+	VGParamType type;
+	int n;								   // number of values, 0 when unknown
+	uint32_t v[SHADOWVEC];
+} shadowparam;
+
+static shadowparam shadow[SHADOWMAX];
+static int nshadow;
+static StateStats statecount, statelast;
+
+// shadowfind returns the shadow entry for a parameter, adding it if there is room
+static shadowparam *shadowfind(VGParamType t) {
+	for (int i = 0; i < nshadow; i++) {
+		if (shadow[i].type == t) {
+			return &shadow[i];
+		}
+	}
+	if (nshadow == SHADOWMAX) {
+		return NULL;
+	}
+	shadowparam *p = &shadow[nshadow++];
+	p->type = t;
+	p->n = 0;
+	return p;
+}
+
+// shadowed reports whether setting a parameter to n values would change nothing,
+// counting the call and otherwise recording the new values
+static int shadowed(VGParamType t, int n, const void *v) {
+	shadowparam *p = shadowfind(t);
+	if (p != NULL && p->n == n && memcmp(p->v, v, n * sizeof(uint32_t)) == 0) {
+		statecount.skipped++;
+		return 1;
+	}
+	statecount.sets++;
+	if (p != NULL) {
+		p->n = n <= SHADOWVEC ? n : 0;
+		memcpy(p->v, v, p->n * sizeof(uint32_t));
+	}
+	return 0;
+}
+
+// setint sets an integer parameter, unless it already has that value
+static void setint(VGParamType t, VGint v) {
+	if (!shadowed(t, 1, &v)) {
+		vgSeti(t, v);
+	}
+}
+
+// setfloat sets a float parameter, unless it already has that value
+static void setfloat(VGParamType t, VGfloat v) {
+	if (!shadowed(t, 1, &v)) {
+		vgSetf(t, v);
+	}
+}
+
+// setints sets an integer vector parameter, unless it already has those values
+static void setints(VGParamType t, int n, const VGint * v) {
+	if (!shadowed(t, n, v)) {
+		vgSetiv(t, n, v);
+	}
+}
+
+// setfloats sets a float vector parameter, unless it already has those values
+static void setfloats(VGParamType t, int n, const VGfloat * v) {
+	if (!shadowed(t, n, v)) {
+		vgSetfv(t, n, v);
+	}
+}
+
+// getint returns an integer parameter, from the shadow when it is known
+static VGint getint(VGParamType t) {
+	shadowparam *p = shadowfind(t);
+	VGint v;
+	if (p != NULL && p->n == 1) {
+		memcpy(&v, p->v, sizeof(v));
+		return v;
+	}
+	v = vgGeti(t);
+	if (p != NULL) {
+		p->n = 1;
+		memcpy(p->v, &v, sizeof(v));
+	}
+	return v;
+}
+
+// getvector reads n values of a parameter, from the shadow when they are known
+static void getvector(VGParamType t, int n, void *v, int isfloat) {
+	shadowparam *p = shadowfind(t);
+	if (p != NULL && p->n == n) {
+		memcpy(v, p->v, n * sizeof(uint32_t));
+		return;
+	}
+	if (isfloat) {
+		vgGetfv(t, n, v);
+	} else {
+		vgGetiv(t, n, v);
+	}
+	if (p != NULL && n <= SHADOWVEC) {
+		p->n = n;
+		memcpy(p->v, v, n * sizeof(uint32_t));
+	}
+}
+
+// StateInfo reports the state changes made and skipped in the last frame
+void StateInfo(StateStats * s) {
+	*s = statelast;
+}
+
+// statetick ends a frame's state counts
+static void statetick() {
+	statelast = statecount;
+	memset(&statecount, 0, sizeof(statecount));
 }
 
 //
 // Transformations
 //
 
+// The transform is composed on the CPU, in VG's column-major layout, and kept on
+// a stack for Push and Pop. It is uploaded only when a draw needs a matrix VG does
+// not already have loaded.
+
+#define MATRIXDEPTH	32
+
+static VGfloat matrixstack[MATRIXDEPTH][9] = { {1, 0, 0, 0, 1, 0, 0, 0, 1} };
+static int matrixtop;
+static int matrixlost;					   // pushes beyond the depth, not saved
+static VGfloat loaded[2][9];				   // matrices loaded for paths and for images
+static int loadedok[2];					   // loaded[] is known
+
+// matmult sets r to a * b; r may be a or b
+static void matmult(VGfloat r[9], const VGfloat a[9], const VGfloat b[9]) {
+	VGfloat t[9];
+	for (int c = 0; c < 3; c++) {
+		for (int row = 0; row < 3; row++) {
+			t[c * 3 + row] = a[row] * b[c * 3] + a[3 + row] * b[c * 3 + 1] + a[6 + row] * b[c * 3 + 2];
+		}
+	}
+	memcpy(r, t, sizeof(t));
+}
+
+// transform multiplies the current transform by m
+static void transform(const VGfloat m[9]) {
+	matmult(matrixstack[matrixtop], matrixstack[matrixtop], m);
+}
+
+// loadmatrix makes m the path or image matrix, uploading it only if it differs
+static void loadmatrix(VGMatrixMode mode, const VGfloat m[9]) {
+	int i = mode == VG_MATRIX_IMAGE_USER_TO_SURFACE;
+	if (loadedok[i] && memcmp(loaded[i], m, sizeof(loaded[i])) == 0) {
+		statecount.skipped++;
+		return;
+	}
+	setint(VG_MATRIX_MODE, mode);
+	vgLoadMatrix(m);
+	memcpy(loaded[i], m, sizeof(loaded[i]));
+	loadedok[i] = 1;
+	statecount.sets++;
+}
+
+// placematrix sets r to the current transform times a scale and offset
+static void placematrix(VGfloat r[9], VGfloat sx, VGfloat sy, VGfloat x, VGfloat y) {
+	VGfloat m[9] = {
+		sx, 0.0f, 0.0f,
+		0.0f, sy, 0.0f,
+		x, y, 1.0f
+	};
+	matmult(r, matrixstack[matrixtop], m);
+}
+
+// drawplaced draws a path scaled and offset within the current transform
+static void drawplaced(VGPath path, VGfloat scale, VGfloat x, VGfloat y, VGbitfield mode) {
+	VGfloat m[9];
+	deferflush();
+	paintsync();
+	placematrix(m, scale, scale, x, y);
+	loadmatrix(VG_MATRIX_PATH_USER_TO_SURFACE, m);
+	vgDrawPath(path, mode);
+}
+
+// drawimageat draws an image with its corner at (x,y) within the current transform
+static void drawimageat(VGImage image, VGfloat x, VGfloat y) {
+	VGfloat m[9];
+	deferflush();
+	paintsync();
+	placematrix(m, 1.0f, 1.0f, x, y);
+	loadmatrix(VG_MATRIX_IMAGE_USER_TO_SURFACE, m);
+	vgDrawImage(image);
+}
+
 // Translate the coordinate system to x,y
 void Translate(VGfloat x, VGfloat y) {
-	vgTranslate(x, y);
+	VGfloat m[9] = { 1, 0, 0, 0, 1, 0, x, y, 1 };
+	transform(m);
 }
 
 // Rotate around angle r
 void Rotate(VGfloat r) {
-	vgRotate(r);
+	VGfloat a = r * (VGfloat) M_PI / 180.0f, c = cosf(a), s = sinf(a);
+	VGfloat m[9] = { c, s, 0, -s, c, 0, 0, 0, 1 };
+	transform(m);
 }
 
 // Shear shears the x coordinate by x degrees, the y coordinate by y degrees
 void Shear(VGfloat x, VGfloat y) {
-	vgShear(x, y);
+	VGfloat m[9] = { 1, y, 0, x, 1, 0, 0, 0, 1 };
+	transform(m);
 }
 
 // Scale scales by  x, y
 void Scale(VGfloat x, VGfloat y) {
-	vgScale(x, y);
+	VGfloat m[9] = { x, 0, 0, 0, y, 0, 0, 0, 1 };
+	transform(m);
+}
+
+// Push saves the current transform. Past 32 levels nothing is saved: the
+// matching Pop leaves the transform as it is, so changes made since are not undone.
+void Push() {
+	if (matrixtop + 1 < MATRIXDEPTH) {
+		memcpy(matrixstack[matrixtop + 1], matrixstack[matrixtop], sizeof(matrixstack[0]));
+		matrixtop++;
+	} else {
+		matrixlost++;
+	}
+}
+
+// Pop restores the transform saved by the matching Push
+void Pop() {
+	if (matrixlost > 0) {
+		matrixlost--;
+	} else if (matrixtop > 0) {
+		matrixtop--;
+	}
+}
+
+// resetmatrix empties the transform stack, leaving the identity
+static void resetmatrix() {
+	static const VGfloat identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	matrixtop = matrixlost = 0;
+	memcpy(matrixstack[0], identity, sizeof(identity));
+}
+
+//
+// Culling
+//
+
+// Each draw is first checked against the view: the screen, narrowed to the scissor
+// rectangle when clipping. The corners of a box that holds everything the draw can
+// touch are taken through the transform, so a draw may pass that shows nothing, but
+// none that shows is rejected. Rejected draws make no paths and load no glyphs.
+
+// viewbox sets v to the visible surface area as x0, y0, x1, y1: the screen,
+// narrowed to the scissor rectangle if scissored is set and clipping is on
+static void viewbox(VGfloat v[4], int scissored) {
+	v[0] = v[1] = 0.0f;
+	v[2] = (VGfloat) state->screen_width;
+	v[3] = (VGfloat) state->screen_height;
+	if (scissored && getint(VG_SCISSORING)) {
+		VGint r[4];
+		getvector(VG_SCISSOR_RECTS, 4, r, 0);
+		v[0] = fmaxf(v[0], r[0]);
+		v[1] = fmaxf(v[1], r[1]);
+		v[2] = fminf(v[2], r[0] + r[2]);
+		v[3] = fminf(v[3], r[1] + r[3]);
+	}
+}
+
+// outside reports whether the box x, y, w, h, grown by pad, falls outside v when
+// placed by m, allowing a pixel for antialiasing
+static int outside(const VGfloat v[4], const VGfloat m[9], VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat pad) {
+	VGfloat b[4] = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	if (w < 0) {
+		x += w, w = -w;
+	}
+	if (h < 0) {
+		y += h, h = -h;
+	}
+	for (int i = 0; i < 4; i++) {
+		VGfloat px = (i & 1) ? x + w + pad : x - pad, py = (i & 2) ? y + h + pad : y - pad;
+		VGfloat sx = (m[0] * px) + (m[3] * py) + m[6], sy = (m[1] * px) + (m[4] * py) + m[7];
+		b[0] = fminf(b[0], sx);
+		b[1] = fminf(b[1], sy);
+		b[2] = fmaxf(b[2], sx);
+		b[3] = fmaxf(b[3], sy);
+	}
+	return b[2] + 1 <= v[0] || b[0] - 1 >= v[2] || b[3] + 1 <= v[1] || b[1] - 1 >= v[3];
+}
+
+// missed is outside, counting the box as culled or drawn
+static int missed(const VGfloat v[4], const VGfloat m[9], VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat pad) {
+	if (outside(v, m, x, y, w, h, pad)) {
+		statecount.culled++;
+		return 1;
+	}
+	statecount.drawn++;
+	return 0;
+}
+
+// culled reports whether the box x, y, w, h, grown by pad, misses the view under
+// the current transform
+static int culled(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat pad) {
+	VGfloat v[4];
+	viewbox(v, 1);
+	return missed(v, matrixstack[matrixtop], x, y, w, h, pad);
+}
+
+// screenculled reports whether pixels set at (x,y), w by h, miss the screen; they are
+// placed without the transform
+static int screenculled(VGfloat x, VGfloat y, VGfloat w, VGfloat h) {
+	static const VGfloat identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	VGfloat v[4];
+	viewbox(v, 0);
+	return missed(v, identity, x, y, w, h, 0.0f);
+}
+
+// pointsculled reports whether n interleaved points, grown by pad, miss the view
+static int pointsculled(const VGfloat * xy, int n, VGfloat pad) {
+	VGfloat b[4] = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int i = 0; i < n; i++) {
+		b[0] = fminf(b[0], xy[2 * i]);
+		b[1] = fminf(b[1], xy[2 * i + 1]);
+		b[2] = fmaxf(b[2], xy[2 * i]);
+		b[3] = fmaxf(b[3], xy[2 * i + 1]);
+	}
+	return n > 0 && culled(b[0], b[1], b[2] - b[0], b[3] - b[1], pad);
+}
+
+// strokepad is how far a draw in mode can reach beyond its path: for strokes, half
+// the width times the default miter limit of 4
+static VGfloat strokepad(VGbitfield mode) {
+	VGfloat width = 0.0f;
+	if (mode & VG_STROKE_PATH) {
+		getvector(VG_STROKE_LINE_WIDTH, 1, &width, 1);
+	}
+	return width > 0 ? width * 2.0f : 0.0f;
 }
 
 //
 // Style functions
 //
 
+// paintslot tracks the paint set for fill or stroke. A color is only chosen
+// until something is drawn with it. Colors normally go into a persistent paint
+// that is recolored in place; colors used again and again get ready-made paints
+// of their own, so switching between them is a single vgSetPaint.
+typedef struct {
+	VGPaint own;						   // persistent paint, recolored in place
+	VGfloat owncolor[4];					   // its color
+	VGPaint bound;						   // paint set for the mode, or VG_INVALID_HANDLE when unknown
+	int colored;						   // the bound paint is a color paint,
+	VGfloat color[4];					   // of this color
+	int stale;						   // a color is chosen but not yet set:
+	VGfloat want[4];					   // this one
+} paintslot;
+
+// colorpaint is a ready-made paint for a frequently used color
+typedef struct {
+	VGfloat color[4];
+	VGPaint paint;
+	unsigned long used;
+} colorpaint;
+
+#define PAINTCACHE	16					   // ready-made color paints
+#define PAINTSEEN	64					   // colors counted for promotion to a paint of their own
+#define PAINTPROMOTE	3					   // uses before a color is promoted
+
+static paintslot fillslot, strokeslot;
+static colorpaint paintcache[PAINTCACHE];
+static struct {
+	VGfloat color[4];
+	int count;
+} paintseen[PAINTSEEN];
+static unsigned long paintclock;
+
+// colorhash hashes the bytes of a color (FNV-1a)
+static unsigned int colorhash(const VGfloat color[4]) {
+	const unsigned char *p = (const unsigned char *)color;
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < 4 * (int)sizeof(VGfloat); i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+// colorpaintfind returns the ready-made paint for a color, or VG_INVALID_HANDLE.
+// A color seen often enough is promoted, recoloring the least recently used paint
+// that is not set for fill or stroke.
+static VGPaint colorpaintfind(const VGfloat color[4]) {
+	colorpaint *victim = NULL;
+
+	for (int i = 0; i < PAINTCACHE; i++) {
+		colorpaint *c = &paintcache[i];
+		if (c->paint != VG_INVALID_HANDLE && memcmp(c->color, color, sizeof(c->color)) == 0) {
+			c->used = ++paintclock;
+			return c->paint;
+		}
+		if (c->paint != VG_INVALID_HANDLE && (c->paint == fillslot.bound || c->paint == strokeslot.bound)) {
+			continue;
+		}
+		if (victim == NULL || c->used < victim->used) {
+			victim = c;
+		}
+	}
+	unsigned int h = colorhash(color) % PAINTSEEN;
+	if (memcmp(paintseen[h].color, color, sizeof(paintseen[h].color)) != 0) {
+		memcpy(paintseen[h].color, color, sizeof(paintseen[h].color));
+		paintseen[h].count = 0;
+	}
+	if (++paintseen[h].count < PAINTPROMOTE || victim == NULL) {
+		return VG_INVALID_HANDLE;
+	}
+	if (victim->paint == VG_INVALID_HANDLE) {
+		victim->paint = vgCreatePaint();
+		vgSetParameteri(victim->paint, VG_PAINT_TYPE, VG_PAINT_TYPE_COLOR);
+	}
+	vgSetParameterfv(victim->paint, VG_PAINT_COLOR, 4, (VGfloat *) color);
+	memcpy(victim->color, color, sizeof(victim->color));
+	victim->used = ++paintclock;
+	return victim->paint;
+}
+
+// setcolor chooses the color of a paint slot; it is set when something is drawn
+static void setcolor(paintslot * ps, VGfloat color[4]) {
+	memcpy(ps->want, color, sizeof(ps->want));
+	ps->stale = 1;
+}
+
+// slotcolor returns the color chosen for a paint slot, or NULL if it holds another paint
+static const VGfloat *slotcolor(const paintslot * ps) {
+	return ps->stale ? ps->want : ps->colored ? ps->color : NULL;
+}
+
+// applycolor sets the chosen color of a paint slot, doing nothing if it is
+// already set and otherwise binding a ready-made paint or recoloring the slot's own
+static void applycolor(paintslot * ps, VGbitfield mode) {
+	VGfloat *color = ps->want;
+
+	if (!ps->stale) {
+		return;
+	}
+	ps->stale = 0;
+	if (ps->colored && ps->bound != VG_INVALID_HANDLE && memcmp(ps->color, color, sizeof(ps->color)) == 0) {
+		statecount.skipped++;
+		return;
+	}
+	VGPaint p = colorpaintfind(color);
+	if (p == VG_INVALID_HANDLE) {
+		if (ps->own == VG_INVALID_HANDLE) {
+			ps->own = vgCreatePaint();
+			vgSetParameteri(ps->own, VG_PAINT_TYPE, VG_PAINT_TYPE_COLOR);
+			vgSetParameterfv(ps->own, VG_PAINT_COLOR, 4, color);
+		} else if (memcmp(ps->owncolor, color, sizeof(ps->owncolor)) != 0) {
+			vgSetParameterfv(ps->own, VG_PAINT_COLOR, 4, color);
+		}
+		memcpy(ps->owncolor, color, sizeof(ps->owncolor));
+		p = ps->own;
+	}
+	if (p != ps->bound) {
+		vgSetPaint(p, mode);
+		ps->bound = p;
+		statecount.sets++;
+	} else {
+		statecount.skipped++;
+	}
+	ps->colored = 1;
+	memcpy(ps->color, color, sizeof(ps->color));
+}
+
+// paintflush destroys the persistent and ready-made paints
+static void paintflush() {
+	for (int i = 0; i < PAINTCACHE; i++) {
+		if (paintcache[i].paint != VG_INVALID_HANDLE) {
+			vgDestroyPaint(paintcache[i].paint);
+		}
+	}
+	memset(paintcache, 0, sizeof(paintcache));
+	memset(paintseen, 0, sizeof(paintseen));
+	if (fillslot.own != VG_INVALID_HANDLE) {
+		vgDestroyPaint(fillslot.own);
+	}
+	if (strokeslot.own != VG_INVALID_HANDLE) {
+		vgDestroyPaint(strokeslot.own);
+	}
+	memset(&fillslot, 0, sizeof(fillslot));
+	memset(&strokeslot, 0, sizeof(strokeslot));
+	gradientflush();
+}
+
+// ResetState forgets the shadowed state, for callers that set VG state directly
+void ResetState() {
+	nshadow = 0;
+	loadedok[0] = loadedok[1] = 0;
+	fillslot.bound = VG_INVALID_HANDLE;
+	strokeslot.bound = VG_INVALID_HANDLE;
+}
+
 // setfill sets the fill color
 void setfill(VGfloat color[4]) {
-	VGPaint fillPaint = vgCreatePaint();
-	vgSetParameteri(fillPaint, VG_PAINT_TYPE, VG_PAINT_TYPE_COLOR);
-	vgSetParameterfv(fillPaint, VG_PAINT_COLOR, 4, color);
-	vgSetPaint(fillPaint, VG_FILL_PATH);
-	vgDestroyPaint(fillPaint);
+	setcolor(&fillslot, color);
 }
 
 // setstroke sets the stroke color
 void setstroke(VGfloat color[4]) {
-	VGPaint strokePaint = vgCreatePaint();
-	vgSetParameteri(strokePaint, VG_PAINT_TYPE, VG_PAINT_TYPE_COLOR);
-	vgSetParameterfv(strokePaint, VG_PAINT_COLOR, 4, color);
-	vgSetPaint(strokePaint, VG_STROKE_PATH);
-	vgDestroyPaint(strokePaint);
+	setcolor(&strokeslot, color);
+}
+
+// paintsync sets the chosen fill and stroke colors before drawing
+static void paintsync() {
+	applycolor(&fillslot, VG_FILL_PATH);
+	applycolor(&strokeslot, VG_STROKE_PATH);
+}
+
+// savedpaint is the paint chosen for fill or stroke, kept while drawing with others
+typedef struct {
+	int colored;
+	VGfloat color[4];
+	VGPaint paint;
+} savedpaint;
+
+// paintsave keeps the paint chosen for a slot
+static void paintsave(const paintslot * ps, savedpaint * sp) {
+	const VGfloat *color = slotcolor(ps);
+	sp->colored = color != NULL;
+	if (color != NULL) {
+		memcpy(sp->color, color, sizeof(sp->color));
+	}
+	sp->paint = ps->bound;
+}
+
+// paintrestore chooses a kept paint for its slot again
+static void paintrestore(paintslot * ps, const savedpaint * sp, VGbitfield mode) {
+	if (sp->colored) {
+		setcolor(ps, (VGfloat *) sp->color);
+	} else if (sp->paint != VG_INVALID_HANDLE && sp->paint != ps->bound) {
+		vgSetPaint(sp->paint, mode);
+		ps->bound = sp->paint;
+		ps->colored = 0;
+		ps->stale = 0;
+	}
 }
 
 // StrokeWidth sets the stroke width
 void StrokeWidth(VGfloat width) {
-	vgSetf(VG_STROKE_LINE_WIDTH, width);
-	vgSeti(VG_STROKE_CAP_STYLE, VG_CAP_BUTT);
-	vgSeti(VG_STROKE_JOIN_STYLE, VG_JOIN_MITER);
+	setfloat(VG_STROKE_LINE_WIDTH, width);
+	setint(VG_STROKE_CAP_STYLE, VG_CAP_BUTT);
+	setint(VG_STROKE_JOIN_STYLE, VG_JOIN_MITER);
 }
 
 //
@@ -310,318 +853,3567 @@ void Fill(unsigned int r, unsigned int g, unsigned int b, VGfloat a) {
 
 // setstops sets color stops for gradients
 void setstop(VGPaint paint, VGfloat * stops, int n) {
+	deferflush();
 	VGboolean multmode = VG_FALSE;
 	VGColorRampSpreadMode spreadmode = VG_COLOR_RAMP_SPREAD_REPEAT;
 	vgSetParameteri(paint, VG_PAINT_COLOR_RAMP_SPREAD_MODE, spreadmode);
 	vgSetParameteri(paint, VG_PAINT_COLOR_RAMP_PREMULTIPLIED, multmode);
 	vgSetParameterfv(paint, VG_PAINT_COLOR_RAMP_STOPS, 5 * n, stops);
 	vgSetPaint(paint, VG_FILL_PATH);
+	fillslot.bound = VG_INVALID_HANDLE;
+	fillslot.colored = 0;
+	fillslot.stale = 0;
 }
 
-// LinearGradient fills with a linear gradient
-void FillLinearGradient(VGfloat x1, VGfloat y1, VGfloat x2, VGfloat y2, VGfloat * stops, int ns) {
-	VGfloat lgcoord[4] = { x1, y1, x2, y2 };
-	VGPaint paint = vgCreatePaint();
-	vgSetParameteri(paint, VG_PAINT_TYPE, VG_PAINT_TYPE_LINEAR_GRADIENT);
-	vgSetParameterfv(paint, VG_PAINT_LINEAR_GRADIENT, 4, lgcoord);
-	setstop(paint, stops, ns);
-	vgDestroyPaint(paint);
-}
-
-// RadialGradient fills with a linear gradient
-void FillRadialGradient(VGfloat cx, VGfloat cy, VGfloat fx, VGfloat fy, VGfloat radius, VGfloat * stops, int ns) {
-	VGfloat radialcoord[5] = { cx, cy, fx, fy, radius };
-	VGPaint paint = vgCreatePaint();
-	vgSetParameteri(paint, VG_PAINT_TYPE, VG_PAINT_TYPE_RADIAL_GRADIENT);
-	vgSetParameterfv(paint, VG_PAINT_RADIAL_GRADIENT, 5, radialcoord);
-	setstop(paint, stops, ns);
-	vgDestroyPaint(paint);
-}
-
-// ClipRect limits the drawing area to specified rectangle
-void ClipRect(VGint x, VGint y, VGint w, VGint h) {
-	vgSeti(VG_SCISSORING, VG_TRUE);
-	VGint coords[4] = { x, y, w, h };
-	vgSetiv(VG_SCISSOR_RECTS, 4, coords);
-}
+// gradient is a gradient paint, with the parameters last uploaded to it
+struct gradient {
+	VGPaint paint;
+	VGPaintType type;
+	VGfloat coords[5];					   // x1, y1, x2, y2 or cx, cy, fx, fy, radius
+	int ncoords;						   // 0 until the coordinates are uploaded
+	VGfloat *stops;
+	int nstops;						   // -1 until the stops are uploaded
+	VGColorRampSpreadMode spread;
+};
 
-// ClipEnd stops limiting drawing area to specified rectangle
-void ClipEnd() {
-	vgSeti(VG_SCISSORING, VG_FALSE);
-}
+// gradentry is a gradient made by the one-shot gradient functions, kept for reuse
+typedef struct {
+	struct gradient g;
+	unsigned int hash;
+	unsigned long used;
+} gradentry;
 
-#define IS_IN_RANGE(c, f, l)    (((c) >= (f)) && ((c) <= (l)))
+#define GRADCACHE 32
 
-char *readNextChar(char *p, int *character) {
-	// TODO: since UTF-8 is a variable-length
-	// encoding, you should pass in the input
-	// buffer's actual byte length so that you
-	// can determine if a malformed UTF-8
-	// sequence would exceed the end of the buffer...
+static gradentry gradcache[GRADCACHE];
+static unsigned long gradclock;
 
-	char c1, c2, *ptr = p;
-	int uc = 0;
-	int seqlen;
-	int datalen = strlen(p);
+// gradhash hashes the type, spread mode, coordinates and stops of a gradient (FNV-1a)
+static unsigned int gradhash(VGPaintType type, VGColorRampSpreadMode spread, const VGfloat * coords, int nc,
+			     const VGfloat * stops, int ns) {
+	unsigned int h = 2166136261u;
+	const unsigned char *p;
+	int key[3] = { type, spread, ns };
 
-	if (datalen < 1) {
-		// malformed data, do something !!!
-		return NULL;
+	for (p = (const unsigned char *)key; p < (const unsigned char *)(key + 3); p++) {
+		h = (h ^ *p) * 16777619u;
 	}
-
-	c1 = ptr[0];
-
-	if ((c1 & 0x80) == 0) {
-		uc = (unsigned long)(c1 & 0x7F);
-		seqlen = 1;
-	} else if ((c1 & 0xE0) == 0xC0) {
-		uc = (unsigned long)(c1 & 0x1F);
-		seqlen = 2;
-	} else if ((c1 & 0xF0) == 0xE0) {
-		uc = (unsigned long)(c1 & 0x0F);
-		seqlen = 3;
-	} else if ((c1 & 0xF8) == 0xF0) {
-		uc = (unsigned long)(c1 & 0x07);
-		seqlen = 4;
-	} else {
-		// malformed data, do something !!!
-		return NULL;
+	for (p = (const unsigned char *)coords; p < (const unsigned char *)(coords + nc); p++) {
+		h = (h ^ *p) * 16777619u;
 	}
+	for (p = (const unsigned char *)stops; p < (const unsigned char *)(stops + 5 * ns); p++) {
+		h = (h ^ *p) * 16777619u;
+	}
+	return h;
+}
 
-	if (seqlen > datalen) {
-		// malformed data, do something !!!
-		return NULL;
+// gradtype makes a gradient's paint if needed and sets its type
+static void gradtype(struct gradient *g, VGPaintType type) {
+	if (g->paint == VG_INVALID_HANDLE) {
+		g->paint = vgCreatePaint();
+		vgSetParameteri(g->paint, VG_PAINT_COLOR_RAMP_PREMULTIPLIED, VG_FALSE);
+		g->spread = VG_COLOR_RAMP_SPREAD_PAD;		   // the OpenVG default
+		g->nstops = -1;
+		g->type = 0;
+	}
+	if (g->type != type) {
+		vgSetParameteri(g->paint, VG_PAINT_TYPE, type);
+		g->type = type;
+		g->ncoords = 0;
 	}
+}
 
-	for (int i = 1; i < seqlen; ++i) {
-		c1 = ptr[i];
+// gradcoords uploads the coordinates of a gradient, if they changed
+static void gradcoords(struct gradient *g, const VGfloat * coords, int nc) {
+	if (g->ncoords != nc || memcmp(g->coords, coords, nc * sizeof(VGfloat)) != 0) {
+		memcpy(g->coords, coords, nc * sizeof(VGfloat));
+		g->ncoords = nc;
+		vgSetParameterfv(g->paint, g->type == VG_PAINT_TYPE_LINEAR_GRADIENT ?
+				 VG_PAINT_LINEAR_GRADIENT : VG_PAINT_RADIAL_GRADIENT, nc, g->coords);
+	}
+}
 
-		if ((c1 & 0xC0) != 0x80) {
-			// malformed data, do something !!!
-			return NULL;
-		}
+// gradstops uploads the color ramp of a gradient, if it changed
+static void gradstops(struct gradient *g, const VGfloat * stops, int ns) {
+	if (g->nstops != ns || memcmp(g->stops, stops, 5 * ns * sizeof(VGfloat)) != 0) {
+		g->stops = realloc(g->stops, (5 * ns + 1) * sizeof(VGfloat));
+		memcpy(g->stops, stops, 5 * ns * sizeof(VGfloat));
+		g->nstops = ns;
+		vgSetParameterfv(g->paint, VG_PAINT_COLOR_RAMP_STOPS, 5 * ns, g->stops);
 	}
+}
 
-	switch (seqlen) {
-	case 2:
-		{
-			c1 = ptr[0];
+// gradspread sets the spread mode of a gradient, if it changed
+static void gradspread(struct gradient *g, VGColorRampSpreadMode spread) {
+	if (g->spread != spread) {
+		vgSetParameteri(g->paint, VG_PAINT_COLOR_RAMP_SPREAD_MODE, spread);
+		g->spread = spread;
+	}
+}
 
-			if (!IS_IN_RANGE(c1, 0xC2, 0xDF)) {
-				// malformed data, do something !!!
-				return NULL;
-			}
+// gradbind sets a gradient as the fill paint, unless it already is
+static void gradbind(struct gradient *g) {
+	if (fillslot.bound != g->paint) {
+		vgSetPaint(g->paint, VG_FILL_PATH);
+		fillslot.bound = g->paint;
+		statecount.sets++;
+	} else {
+		statecount.skipped++;
+	}
+	fillslot.colored = 0;
+	fillslot.stale = 0;
+}
 
-			break;
+// gradfree destroys a gradient's paint and stops, unsetting it if it is the fill
+static void gradfree(struct gradient *g) {
+	if (g->paint != VG_INVALID_HANDLE) {
+		if (fillslot.bound == g->paint) {
+			fillslot.bound = VG_INVALID_HANDLE;
 		}
+		vgDestroyPaint(g->paint);
+	}
+	free(g->stops);
+	memset(g, 0, sizeof(*g));
+}
 
-	case 3:
-		{
-			c1 = ptr[0];
-			c2 = ptr[1];
-
-			if (((c1 == 0xE0) && !IS_IN_RANGE(c2, 0xA0, 0xBF)) ||
-			    ((c1 == 0xED) && !IS_IN_RANGE(c2, 0x80, 0x9F)) ||
-			    (!IS_IN_RANGE(c1, 0xE1, 0xEC) && !IS_IN_RANGE(c1, 0xEE, 0xEF))) {
-				// malformed data, do something !!!
-				return NULL;
-			}
+// fillgradient fills with a gradient from the cache, rebinding an identical one if
+// there is one and otherwise reusing the least recently used entry, uploading only
+// the parameters that differ from its last use
+static void fillgradient(VGPaintType type, VGfloat * coords, int nc, VGfloat * stops, int ns) {
+	unsigned int h = gradhash(type, VG_COLOR_RAMP_SPREAD_REPEAT, coords, nc, stops, ns);
+	gradentry *victim = NULL;
 
-			break;
+	for (int i = 0; i < GRADCACHE; i++) {
+		gradentry *e = &gradcache[i];
+		struct gradient *g = &e->g;
+		if (g->paint != VG_INVALID_HANDLE && e->hash == h && g->type == type && g->nstops == ns &&
+		    memcmp(g->coords, coords, nc * sizeof(VGfloat)) == 0 &&
+		    memcmp(g->stops, stops, 5 * ns * sizeof(VGfloat)) == 0) {
+			e->used = ++gradclock;
+			gradbind(g);
+			return;
 		}
-
-	case 4:
-		{
-			c1 = ptr[0];
-			c2 = ptr[1];
-
-			if (((c1 == 0xF0) && !IS_IN_RANGE(c2, 0x90, 0xBF)) ||
-			    ((c1 == 0xF4) && !IS_IN_RANGE(c2, 0x80, 0x8F)) || !IS_IN_RANGE(c1, 0xF1, 0xF3)) {
-				// malformed data, do something !!!
-				return NULL;
-			}
-
-			break;
+		if ((g->paint == VG_INVALID_HANDLE || g->paint != fillslot.bound) && (victim == NULL || e->used < victim->used)) {
+			victim = e;
 		}
 	}
+	gradtype(&victim->g, type);
+	gradspread(&victim->g, VG_COLOR_RAMP_SPREAD_REPEAT);
+	gradcoords(&victim->g, coords, nc);
+	gradstops(&victim->g, stops, ns);
+	victim->hash = h;
+	victim->used = ++gradclock;
+	gradbind(&victim->g);
+}
 
-	for (int i = 1; i < seqlen; ++i) {
-		uc = ((uc << 6) | (unsigned long)(ptr[i] & 0x3F));
+// gradientflush destroys the cached gradients
+static void gradientflush() {
+	for (int i = 0; i < GRADCACHE; i++) {
+		gradfree(&gradcache[i].g);
+		gradcache[i].hash = 0;
+		gradcache[i].used = 0;
 	}
+}
 
-	*character = uc;
-	p += seqlen;
-	return p;
+// LinearGradient fills with a linear gradient
+void FillLinearGradient(VGfloat x1, VGfloat y1, VGfloat x2, VGfloat y2, VGfloat * stops, int ns) {
+	VGfloat lgcoord[4] = { x1, y1, x2, y2 };
+	fillgradient(VG_PAINT_TYPE_LINEAR_GRADIENT, lgcoord, 4, stops, ns);
 }
 
-void Text(VGfloat x, VGfloat y, char *s, int pointsize) {
-	float size = (VGfloat) pointsize, xx = x, mm[9];
+// RadialGradient fills with a linear gradient
+void FillRadialGradient(VGfloat cx, VGfloat cy, VGfloat fx, VGfloat fy, VGfloat radius, VGfloat * stops, int ns) {
+	VGfloat radialcoord[5] = { cx, cy, fx, fy, radius };
+	fillgradient(VG_PAINT_TYPE_RADIAL_GRADIENT, radialcoord, 5, stops, ns);
+}
 
-	vgGetMatrix(mm);
-	int character;
-	char *ss = s;
-	int error;
-	while ((ss = readNextChar(ss, &character)) != NULL) {
-		int glyphIndex = FT_Get_Char_Index(face, character);
-
-		error = FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM);
-		assert(error == 0);
-
-		int *points = NULL;
-		int point_len = 0;
-		unsigned char *instructions = NULL;
-		int instruction_len = 0;
-		FT_Outline outline = face->glyph->outline;
-		float minx = 0.0f, miny = 0.0f, maxx = 0.0f, maxy = 0.0f;
-		int s = 0, e;
-		for (int con = 0; con < outline.n_contours; ++con) {
-			int pnts = 1;
-			e = outline.contours[con] + 1;
-
-			//read the contour start point
-			instruction_len += 1;
-			instructions = realloc(instructions, instruction_len * sizeof(unsigned char));
-			instructions[instruction_len - 1] = 2;
-			point_len += 2;
-			points = realloc(points, point_len * sizeof(int));
-			points[point_len - 2] = outline.points[s].x * 16.0f;
-			points[point_len - 1] = outline.points[s].y * 16.0f;
-
-			int i = s + 1;
-			while (i <= e) {
-				int c = (i == e) ? s : i;
-				int n = (i == e - 1) ? s : (i + 1);
-				if (outline.tags[c] & 1) { //line
-					++i;
-					instruction_len += 1;
-					instructions = realloc(instructions, instruction_len * sizeof(unsigned char));
-					instructions[instruction_len - 1] = 4;
-					point_len += 2;
-					points = realloc(points, point_len * sizeof(int));
-					points[point_len - 2] = outline.points[c].x * 16.0f;
-					points[point_len - 1] = outline.points[c].y * 16.0f;
-					pnts += 1;
-				} else {		   //spline
-					instruction_len += 1;
-					instructions = realloc(instructions, instruction_len * sizeof(unsigned char));
-					instructions[instruction_len - 1] = 10;
-					point_len += 2;
-					points = realloc(points, point_len * sizeof(int));
-					points[point_len - 2] = outline.points[c].x * 16.0f;
-					points[point_len - 1] = outline.points[c].y * 16.0f;
-					if (outline.tags[n] & 1) {	//next on
-						point_len += 2;
-						points = realloc(points, point_len * sizeof(int));
-						points[point_len - 2] = outline.points[n].x * 16.0f;
-						points[point_len - 1] = outline.points[n].y * 16.0f;
-						i += 2;
-					} else {	   //next off, use middle point
-						point_len += 2;
-						points = realloc(points, point_len * sizeof(int));
-						points[point_len - 2] = (outline.points[c].x + outline.points[c].x) * 16.0f * 0.5f;
-						points[point_len - 1] = (outline.points[c].y + outline.points[c].y) * 16.0f * 0.5f;
-						++i;
-					}
-					pnts += 2;
-				}
-			}
-			instruction_len += 1;
-			instructions = realloc(instructions, instruction_len * sizeof(unsigned char));
-			instructions[instruction_len - 1] = 0;
-			s = e;
-		}
+// NewLinearGradient makes a linear gradient for repeated use with FillGradient
+Gradient NewLinearGradient(VGfloat x1, VGfloat y1, VGfloat x2, VGfloat y2, VGfloat * stops, int ns) {
+	struct gradient *g = calloc(1, sizeof(struct gradient));
+	VGfloat lgcoord[4] = { x1, y1, x2, y2 };
+	gradtype(g, VG_PAINT_TYPE_LINEAR_GRADIENT);
+	gradspread(g, VG_COLOR_RAMP_SPREAD_REPEAT);
+	gradcoords(g, lgcoord, 4);
+	gradstops(g, stops, ns);
+	return g;
+}
 
-		for (unsigned int i = 0; i < point_len / 2; ++i) {
-			if (points[i * 2] < minx)
-				minx = points[i * 2];
-			if (points[i * 2] > maxx)
-				maxx = points[i * 2];
-			if (points[i * 2 + 1] < miny)
-				miny = points[i * 2 + 1];
-			if (points[i * 2 + 1] > maxy)
-				maxy = points[i * 2 + 1];
-		}
+// NewRadialGradient makes a radial gradient for repeated use with FillGradient
+Gradient NewRadialGradient(VGfloat cx, VGfloat cy, VGfloat fx, VGfloat fy, VGfloat radius, VGfloat * stops, int ns) {
+	struct gradient *g = calloc(1, sizeof(struct gradient));
+	VGfloat radialcoord[5] = { cx, cy, fx, fy, radius };
+	gradtype(g, VG_PAINT_TYPE_RADIAL_GRADIENT);
+	gradspread(g, VG_COLOR_RAMP_SPREAD_REPEAT);
+	gradcoords(g, radialcoord, 5);
+	gradstops(g, stops, ns);
+	return g;
+}
 
-		VGPath path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_S_32,
-					   1.0f / 65536.0f, 0.0f, 0, 0,
-					   VG_PATH_CAPABILITY_ALL);
-		if (instruction_len > 0) {
-			vgAppendPathData(path, instruction_len, instructions, points);
-		}
+// LinearGradientPoints moves the end points of a linear gradient, leaving its ramp alone
+void LinearGradientPoints(Gradient g, VGfloat x1, VGfloat y1, VGfloat x2, VGfloat y2) {
+	VGfloat lgcoord[4] = { x1, y1, x2, y2 };
+	gradtype(g, VG_PAINT_TYPE_LINEAR_GRADIENT);
+	gradcoords(g, lgcoord, 4);
+}
 
-		VGfloat mat[9] = {
-			size, 0.0f, 0.0f,
-			0.0f, size, 0.0f,
-			xx, y, 1.0f
-		};
-		free(points);
-		free(instructions);
-		vgLoadMatrix(mm);
-		vgMultMatrix(mat);
-		vgDrawPath(path, VG_FILL_PATH);
-		xx += size * (float)face->glyph->advance.x / 4096.0f;
-	}
-	vgLoadMatrix(mm);
+// RadialGradientPoints moves the center, focus and radius of a radial gradient, leaving its ramp alone
+void RadialGradientPoints(Gradient g, VGfloat cx, VGfloat cy, VGfloat fx, VGfloat fy, VGfloat radius) {
+	VGfloat radialcoord[5] = { cx, cy, fx, fy, radius };
+	gradtype(g, VG_PAINT_TYPE_RADIAL_GRADIENT);
+	gradcoords(g, radialcoord, 5);
 }
 
-// TextWidth returns the width of a text string at the specified font and size.
-VGfloat TextWidth(char *s, int pointsize) {
-	VGfloat tw = 0.0;
-	VGfloat size = (VGfloat) pointsize;
-	int character;
-	char *ss = s;
-	int error;
-	while ((ss = readNextChar(ss, &character)) != NULL) {
-		int glyphIndex = FT_Get_Char_Index(face, character);
+// GradientStops replaces the color stops of a gradient
+void GradientStops(Gradient g, VGfloat * stops, int ns) {
+	gradstops(g, stops, ns);
+}
+
+// GradientSpread sets how a gradient continues beyond its ends: VG_COLOR_RAMP_SPREAD_PAD,
+// VG_COLOR_RAMP_SPREAD_REPEAT (the default here) or VG_COLOR_RAMP_SPREAD_REFLECT
+void GradientSpread(Gradient g, VGColorRampSpreadMode spread) {
+	gradspread(g, spread);
+}
 
-		error = FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM);
-		assert(error == 0);
-		tw += size * (float)face->glyph->advance.x / 4096.0f;
+// FillGradient fills with a gradient made by NewLinearGradient or NewRadialGradient
+void FillGradient(Gradient g) {
+	gradbind(g);
+}
+
+// DeleteGradient frees a gradient
+void DeleteGradient(Gradient g) {
+	if (g != NULL) {
+		gradfree(g);
+		free(g);
 	}
-	return tw;
 }
 
-// TextMid draws text, centered on (x,y)
-void TextMid(VGfloat x, VGfloat y, char *s, int pointsize) {
-	VGfloat tw = TextWidth(s, pointsize);
-	Text(x - (tw / 2.0), y, s, pointsize);
+// ClipRect limits the drawing area to specified rectangle
+void ClipRect(VGint x, VGint y, VGint w, VGint h) {
+	VGint coords[4] = { x, y, w, h };
+	setint(VG_SCISSORING, VG_TRUE);
+	setints(VG_SCISSOR_RECTS, 4, coords);
 }
 
-// TextEnd draws text, with its end aligned to (x,y)
-void TextEnd(VGfloat x, VGfloat y, char *s, int pointsize) {
-	VGfloat tw = TextWidth(s, pointsize);
-	Text(x - tw, y, s, pointsize);
+// ClipEnd stops limiting drawing area to specified rectangle
+void ClipEnd() {
+	setint(VG_SCISSORING, VG_FALSE);
 }
 
 //
-// Shape functions
+// UTF-8 decoding
 //
 
-// newpath creates path data
-VGPath newpath() {
-	return vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F, 1.0f, 0.0f, 0, 0, VG_PATH_CAPABILITY_ALL);
+// utf8ascii copies the leading run of ASCII bytes of s as codepoints, a vector
+// at a time, and returns its length; the scalar decoder picks up from there
+static int utf8ascii(const unsigned char *s, int n, unsigned int *out) {
+	int i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8(s + i);
+		uint8x8_t any = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+		if (vget_lane_u64(vreinterpret_u64_u8(any), 0) & 0x8080808080808080ULL) {
+			break;
+		}
+		uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+		vst1q_u32(out + i, vmovl_u16(vget_low_u16(lo)));
+		vst1q_u32(out + i + 4, vmovl_u16(vget_high_u16(lo)));
+		vst1q_u32(out + i + 8, vmovl_u16(vget_low_u16(hi)));
+		vst1q_u32(out + i + 12, vmovl_u16(vget_high_u16(hi)));
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		if (_mm_movemask_epi8(v) != 0) {
+			break;
+		}
+		__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i *) (out + i), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *) (out + i + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *) (out + i + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i *) (out + i + 12), _mm_unpackhi_epi16(hi, zero));
+	}
+#else
+	for (; i + 8 <= n; i += 8) {
+		uint64_t w;
+		memcpy(&w, s + i, 8);
+		if (w & 0x8080808080808080ULL) {
+			break;
+		}
+		for (int k = 0; k < 8; k++) {
+			out[i + k] = s[i + k];
+		}
+	}
+#endif
+	return i;
+}
+
+// utf8next decodes the codepoint at the start of n > 0 bytes into *c and returns
+// the number of bytes it used. Decoding is strict: overlong forms, surrogates,
+// values past U+10FFFF and sequences cut short, including by the end of the
+// buffer, decode as U+FFFD using one byte, so decoding resumes at the next byte.
+static int utf8next(const unsigned char *s, int n, unsigned int *c) {
+	unsigned int uc = s[0];
+	unsigned char lo = 0x80, hi = 0xBF;			   // allowed range of the second byte
+	int len, k;
+
+	if (uc < 0x80) {
+		*c = uc;
+		return 1;
+	} else if (uc >= 0xC2 && uc <= 0xDF) {
+		uc &= 0x1F, len = 2;
+	} else if (uc >= 0xE0 && uc <= 0xEF) {
+		if (uc == 0xE0)
+			lo = 0xA0;				   // overlong
+		else if (uc == 0xED)
+			hi = 0x9F;				   // surrogates
+		uc &= 0x0F, len = 3;
+	} else if (uc >= 0xF0 && uc <= 0xF4) {
+		if (uc == 0xF0)
+			lo = 0x90;				   // overlong
+		else if (uc == 0xF4)
+			hi = 0x8F;				   // past U+10FFFF
+		uc &= 0x07, len = 4;
+	} else {
+		*c = 0xFFFD;
+		return 1;
+	}
+	for (k = 1; k < len && k < n; k++) {
+		unsigned char b = s[k];
+		if (k == 1 ? (b < lo || b > hi) : (b & 0xC0) != 0x80) {
+			break;
+		}
+		uc = (uc << 6) | (b & 0x3F);
+	}
+	if (k < len) {
+		*c = 0xFFFD;
+		return 1;
+	}
+	*c = uc;
+	return len;
+}
+
+// utf8decode decodes n bytes of UTF-8 into out, which must have room for n
+// codepoints, and returns the number of codepoints
+static int utf8decode(const char *str, int n, unsigned int *out) {
+	const unsigned char *s = (const unsigned char *)str;
+	int i = 0, nc = 0;
+
+	while (i < n) {
+		if (s[i] < 0x80) {
+			int run = utf8ascii(s + i, n - i, out + nc);
+			i += run, nc += run;
+			while (i < n && s[i] < 0x80) {
+				out[nc++] = s[i++];
+			}
+			continue;
+		}
+		i += utf8next(s + i, n - i, &out[nc++]);
+	}
+	return nc;
+}
+
+static unsigned int *codebuf;					   // decoded codepoints, reused
+static int codecap;
+
+// decode decodes n bytes of UTF-8 into the shared codepoint buffer
+static int decode(const char *s, int n) {
+	if (n > codecap) {
+		codecap = n * 2;
+		codebuf = realloc(codebuf, codecap * sizeof(unsigned int));
+	}
+	return utf8decode(s, n, codebuf);
+}
+
+//
+// Glyph cache
+//
+
+// glyph is a built outline path for one glyph of a face, kept in the glyph cache
+typedef struct glyph {
+	void *face;						   // owning face
+	unsigned int index;					   // glyph index within the face
+	VGPath path;						   // outline, at unit size
+	VGfloat advance;					   // horizontal advance, at unit size
+	unsigned long bytes;					   // approximate memory held by the path
+	struct glyph *hnext;					   // next in hash chain
+	struct glyph *prev, *next;				   // LRU list, most recently used first
+} glyph;
+
+#define GLYPHBUCKETS 4096
+#define GLYPHOVERHEAD 64					   // per-path driver overhead estimate, in bytes
+
+static glyph *glyphtab[GLYPHBUCKETS];
+static glyph *glyphlru, *glyphmru;				   // least and most recently used
+static int glyphmax = 2048;					   // entry budget, 0 for unlimited
+static unsigned long glyphmaxbytes = 4 << 20;			   // memory budget, 0 for unlimited
+static GlyphCacheStats glyphstats;
+
+// glyphhash hashes a (face, glyph index) key
+static unsigned int glyphhash(void *face, unsigned int index) {
+	return ((unsigned int)((uintptr_t) face >> 4) * 31 + index) & (GLYPHBUCKETS - 1);
+}
+
+// glyphunlink removes a glyph from the LRU list
+static void glyphunlink(glyph * g) {
+	if (g->prev)
+		g->prev->next = g->next;
+	else
+		glyphmru = g->next;
+	if (g->next)
+		g->next->prev = g->prev;
+	else
+		glyphlru = g->prev;
+	g->prev = g->next = NULL;
+}
+
+// glyphfront makes a glyph the most recently used
+static void glyphfront(glyph * g) {
+	g->prev = NULL;
+	g->next = glyphmru;
+	if (glyphmru)
+		glyphmru->prev = g;
+	glyphmru = g;
+	if (glyphlru == NULL)
+		glyphlru = g;
+}
+
+// glyphdrop removes a glyph from the cache and destroys its path
+static void glyphdrop(glyph * g) {
+	glyph **pp = &glyphtab[glyphhash(g->face, g->index)];
+	while (*pp != g)
+		pp = &(*pp)->hnext;
+	*pp = g->hnext;
+	glyphunlink(g);
+	vgDestroyPath(g->path);
+	glyphstats.entries--;
+	glyphstats.bytes -= g->bytes;
+	free(g);
+}
+
+// glyphtrim evicts least recently used glyphs until another n glyphs
+// holding the given number of bytes fit within the budget
+static void glyphtrim(int n, unsigned long bytes) {
+	while (glyphlru != NULL && ((glyphmax > 0 && glyphstats.entries + n > glyphmax) ||
+				     (glyphmaxbytes > 0 && glyphstats.bytes + bytes > glyphmaxbytes))) {
+		glyphdrop(glyphlru);
+		glyphstats.evictions++;
+	}
+}
+
+//
+// Outline conversion
+//
+
+// pathbuilder accumulates VG path segments and coordinates; its buffers
+// are grown as needed and reused from one path to the next
+typedef struct {
+	VGubyte *segs;
+	VGint *coords;
+	int nseg, ncoord;
+	int segcap, coordcap;
+	int open;						   // a subpath is in progress
+} pathbuilder;
+
+static pathbuilder glyphbuf;
+
+// pbreserve makes room for at least nseg more segments and ncoord more coordinates
+static void pbreserve(pathbuilder * pb, int nseg, int ncoord) {
+	if (pb->nseg + nseg > pb->segcap) {
+		pb->segcap = (pb->nseg + nseg) * 2;
+		pb->segs = realloc(pb->segs, pb->segcap * sizeof(VGubyte));
+	}
+	if (pb->ncoord + ncoord > pb->coordcap) {
+		pb->coordcap = (pb->ncoord + ncoord) * 2;
+		pb->coords = realloc(pb->coords, pb->coordcap * sizeof(VGint));
+	}
+}
+
+// pbreset empties a path builder, keeping its buffers
+static void pbreset(pathbuilder * pb) {
+	pb->nseg = pb->ncoord = 0;
+	pb->open = 0;
+}
+
+// pbseg appends one segment and its n points
+static void pbseg(pathbuilder * pb, VGubyte seg, const FT_Vector * p, int n) {
+	pbreserve(pb, 1, n * 2);
+	pb->segs[pb->nseg++] = seg;
+	for (int i = 0; i < n; i++) {
+		pb->coords[pb->ncoord++] = p[i].x * 16;		   // 26.6 to the S_32 path scale
+		pb->coords[pb->ncoord++] = p[i].y * 16;
+	}
+}
+
+// pbclose closes the subpath in progress, if any
+static void pbclose(pathbuilder * pb) {
+	if (pb->open) {
+		pbreserve(pb, 1, 0);
+		pb->segs[pb->nseg++] = VG_CLOSE_PATH;
+		pb->open = 0;
+	}
+}
+
+static int outlinemove(const FT_Vector * to, void *user) {
+	pathbuilder *pb = user;
+	pbclose(pb);
+	pbseg(pb, VG_MOVE_TO_ABS, to, 1);
+	pb->open = 1;
+	return 0;
+}
+
+static int outlineline(const FT_Vector * to, void *user) {
+	pbseg(user, VG_LINE_TO_ABS, to, 1);
+	return 0;
+}
+
+static int outlineconic(const FT_Vector * control, const FT_Vector * to, void *user) {
+	FT_Vector p[2] = { *control, *to };
+	pbseg(user, VG_QUAD_TO_ABS, p, 2);
+	return 0;
+}
+
+static int outlinecubic(const FT_Vector * c1, const FT_Vector * c2, const FT_Vector * to, void *user) {
+	FT_Vector p[3] = { *c1, *c2, *to };
+	pbseg(user, VG_CUBIC_TO_ABS, p, 3);
+	return 0;
+}
+
+static const FT_Outline_Funcs outlinefuncs = {
+	outlinemove, outlineline, outlineconic, outlinecubic, 0, 0
+};
+
+// outlinepath converts a FreeType outline into path segments and coordinates.
+// FreeType resolves implied on-curve points, so conics come out as plain quads.
+static void outlinepath(pathbuilder * pb, FT_Outline * o) {
+	pbreset(pb);
+	// each point yields at most one segment of at most two coordinate pairs,
+	// plus a move and a close per contour
+	pbreserve(pb, o->n_points + (2 * o->n_contours), 4 * (o->n_points + o->n_contours));
+	FT_Outline_Decompose(o, &outlinefuncs, pb);
+	pbclose(pb);
+}
+
+// pbpath makes a VG path from the contents of a path builder, reporting its size in bytes
+static VGPath pbpath(pathbuilder * pb, unsigned long *bytes) {
+	VGPath path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_S_32,
+				   1.0f / 65536.0f, 0.0f, pb->nseg, pb->ncoord,
+				   VG_PATH_CAPABILITY_ALL);
+	if (pb->nseg > 0) {
+		vgAppendPathData(path, pb->nseg, pb->segs, pb->coords);
+	}
+	*bytes = GLYPHOVERHEAD + pb->nseg + (pb->ncoord * sizeof(VGint));
+	return path;
+}
+
+// glyphpath builds a VG path from a FreeType outline, reporting its size in bytes
+static VGPath glyphpath(FT_Outline * o, unsigned long *bytes) {
+	outlinepath(&glyphbuf, o);
+	return pbpath(&glyphbuf, bytes);
+}
+
+// glyphfind returns the cached glyph for a face and glyph index, or NULL on a miss
+static glyph *glyphfind(void *face, unsigned int index) {
+	glyph *g;
+
+	for (g = glyphtab[glyphhash(face, index)]; g != NULL; g = g->hnext) {
+		if (g->face == face && g->index == index) {
+			glyphstats.hits++;
+			if (g != glyphmru) {
+				glyphunlink(g);
+				glyphfront(g);
+			}
+			return g;
+		}
+	}
+	glyphstats.misses++;
+	return NULL;
+}
+
+// glyphcached reports whether a glyph is cached, without counting a lookup or touching its age
+static int glyphcached(void *face, unsigned int index) {
+	for (glyph * g = glyphtab[glyphhash(face, index)]; g != NULL; g = g->hnext) {
+		if (g->face == face && g->index == index) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// glyphadd caches a newly built glyph path, evicting others to stay within budget
+static glyph *glyphadd(void *face, unsigned int index, VGPath path, VGfloat advance, unsigned long bytes) {
+	unsigned int h = glyphhash(face, index);
+	glyph *g = malloc(sizeof(glyph));
+
+	g->face = face;
+	g->index = index;
+	g->path = path;
+	g->advance = advance;
+	g->bytes = bytes;
+	glyphtrim(1, bytes);
+	g->hnext = glyphtab[h];
+	glyphtab[h] = g;
+	glyphfront(g);
+	glyphstats.entries++;
+	glyphstats.bytes += bytes;
+	return g;
+}
+
+// getglyph returns the cached glyph for a face and glyph index, building it on a miss
+static glyph *getglyph(FT_Face f, unsigned int index) {
+	glyph *g = glyphfind(f, index);
+	unsigned long bytes;
+	int error;
+
+	if (g != NULL) {
+		return g;
+	}
+	error = FT_Load_Glyph(f, index, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM);
+	assert(error == 0);
+
+	VGPath path = glyphpath(&f->glyph->outline, &bytes);
+	return glyphadd(f, index, path, (VGfloat) f->glyph->advance.x / 4096.0f, bytes);
+}
+
+// GlyphCacheLimit sets the glyph cache budget, in entries and bytes (0 means no limit)
+void GlyphCacheLimit(int maxglyphs, unsigned long maxbytes) {
+	glyphmax = maxglyphs;
+	glyphmaxbytes = maxbytes;
+	glyphtrim(0, 0);
+}
+
+// GlyphCacheFlush destroys all cached glyph paths
+void GlyphCacheFlush() {
+	while (glyphlru != NULL)
+		glyphdrop(glyphlru);
+}
+
+// GlyphCacheInfo reports glyph cache counters
+void GlyphCacheInfo(GlyphCacheStats * s) {
+	*s = glyphstats;
+}
+
+//
+// Font registry
+//
+
+// metric is the layout data of one codepoint, at unit size
+typedef struct {
+	int index;						   // glyph index or bundle position, METRICNONE or METRICUNSET
+	int font;						   // registered font that supplies the glyph
+	int mapped;						   // the codepoint is in that font, not its missing glyph
+	VGfloat advance;
+	VGfloat bbox[4];					   // minx, miny, maxx, maxy of the outline
+} metric;
+
+#define METRICNONE	-1					   // no font in the chain has a glyph for the codepoint
+#define METRICUNSET	-2					   // not looked up yet
+#define METRICPAGE	256
+#define METRICPAGES	(0x110000 / METRICPAGE)
+
+// metrictable maps codepoints to metrics for one font, a page of codepoints at a time
+typedef struct {
+	metric *page[METRICPAGES];
+} metrictable;
+
+#define KERNPAIRS	4096					   // kerning pairs kept per face
+
+// kernpair is the kerning between two glyphs of a face, at unit size
+typedef struct {
+	int left, right;					   // glyph indexes; left is -1 in an unused entry
+	VGfloat dx;
+} kernpair;
+
+// font is a registered face: either a FreeType face reading its file through a
+// shared read-only mapping, or a precompiled outline bundle mapped the same way
+typedef struct {
+	char *path;
+	void *map;						   // the mapped file
+	size_t maplen;
+	FT_Face face;						   // NULL for bundles
+	const vgfheader *bundle;				   // NULL for FreeType faces
+	int fallback;						   // font tried for missing codepoints, -1 for none
+	int state;						   // FONTREADY, or still loading or failed in the background
+	metrictable metrics;					   // lookups through this font and its fallbacks
+	kernpair *kerns;					   // pairs looked up in this face, made on first use
+	VGfloat reach[5];					   // widest advance and the box of all glyphs, at unit size
+	int reached;						   // reach is known
+} font;
+
+#define FONTREADY	0
+#define FONTPENDING	1
+#define FONTFAILED	2
+
+#define MAXFONTS 16
+
+static font fonts[MAXFONTS];
+static int nfonts;
+static int textfont = -1;					   // selected font
+static unsigned int fontgen;					   // bumped when fonts or fallbacks change
+
+// fontsource is the font worker's view of a registered font. The render thread
+// fills it for fonts it loads itself; the worker fills it for background loads,
+// and the render thread copies the result into the font once it is done.
+typedef struct {
+	char *path;
+	void *map;
+	size_t len;
+	const vgfheader *bundle;
+	FT_Face face;						   // face made by the worker for the render thread
+	FT_Face warm;						   // the worker's own face, for prewarming
+	int state;						   // LOADPENDING, LOADDONE, LOADFAILED or LOADINSTALLED
+} fontsource;
+
+#define LOADPENDING	0
+#define LOADDONE	1
+#define LOADFAILED	2
+#define LOADINSTALLED	3
+
+static fontsource sources[MAXFONTS];
+static pthread_mutex_t worklock = PTHREAD_MUTEX_INITIALIZER;	   // guards the worker's queues and source states
+static pthread_mutex_t ftlock = PTHREAD_MUTEX_INITIALIZER;	   // FreeType face creation and disposal
+
+// metricsreset forgets the metrics of every font, as when a fallback chain changes
+static void metricsreset() {
+	for (int f = 0; f < nfonts; f++) {
+		for (int i = 0; i < METRICPAGES; i++) {
+			free(fonts[f].metrics.page[i]);
+			fonts[f].metrics.page[i] = NULL;
+		}
+	}
+	fontgen++;
+}
+
+// mapfile maps a whole file read-only and shared, so processes using the same font share its pages
+static void *mapfile(char *filename, size_t * len) {
+	struct stat st;
+	void *p;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+	*len = st.st_size;
+	return p;
+}
+
+// findfont returns the id of a font already registered from a file, or -1
+static int findfont(char *filename) {
+	for (int i = 0; i < nfonts; i++) {
+		if (strcmp(fonts[i].path, filename) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// addfont registers a mapped font, selecting it if no font is selected yet
+static int addfont(char *filename, void *map, size_t len, FT_Face ft, const vgfheader * bundle) {
+	font *f = &fonts[nfonts];
+
+	memset(f, 0, sizeof(*f));
+	f->path = strdup(filename);
+	f->map = map;
+	f->maplen = len;
+	f->face = ft;
+	f->bundle = bundle;
+	f->fallback = -1;
+	if (textfont < 0) {
+		textfont = nfonts;
+	}
+	pthread_mutex_lock(&worklock);
+	sources[nfonts].path = f->path;
+	sources[nfonts].map = map;
+	sources[nfonts].len = len;
+	sources[nfonts].bundle = bundle;
+	sources[nfonts].state = LOADINSTALLED;
+	pthread_mutex_unlock(&worklock);
+	fontgen++;
+	return nfonts++;
+}
+
+// LoadFont registers a TrueType or OpenType font and returns its id, or -1 on failure.
+// The file is mapped shared and read-only and handed to FreeType as a memory face,
+// and loading the same file again returns the same id.
+int LoadFont(char *filename) {
+	FT_Face ft;
+	size_t len;
+	void *map;
+	int id = findfont(filename);
+
+	if (id >= 0) {
+		return id;
+	}
+	if (nfonts == MAXFONTS) {
+		return -1;
+	}
+	if (library == NULL && FT_Init_FreeType(&library) != 0) {
+		return -1;
+	}
+	if ((map = mapfile(filename, &len)) == NULL) {
+		return -1;
+	}
+	pthread_mutex_lock(&ftlock);
+	int error = FT_New_Memory_Face(library, map, len, 0, &ft);
+	pthread_mutex_unlock(&ftlock);
+	if (error != 0) {
+		munmap(map, len);
+		return -1;
+	}
+	FT_Set_Char_Size(ft, 0, 64 * 64, 96, 96);
+	startupmark(&startup.fontready);
+	return addfont(filename, map, len, ft, NULL);
+}
+
+// bundleok checks that a mapped file is a bundle whose tables lie within it
+static int bundleok(const vgfheader * h, size_t len) {
+	return len >= sizeof(vgfheader) && h->magic == VGF_MAGIC && h->version == VGF_VERSION &&
+	    h->glyphoffset + (uint64_t) h->nglyphs * sizeof(vgfglyph) <= len &&
+	    h->segoffset + (uint64_t) h->nsegs <= len &&
+	    h->coordoffset + (uint64_t) h->ncoords * sizeof(int32_t) <= len && (h->coordoffset & 3) == 0;
+}
+
+// LoadFontBundle registers a precompiled outline bundle made by fontutil/font2vgf and
+// returns its id, or -1 on failure. Glyph data pages in on first use and is shared
+// between processes mapping the same file; no FreeType is involved.
+int LoadFontBundle(char *filename) {
+	const vgfheader *h;
+	size_t len;
+	int id = findfont(filename);
+
+	if (id >= 0) {
+		return id;
+	}
+	if (nfonts == MAXFONTS || (h = mapfile(filename, &len)) == NULL) {
+		return -1;
+	}
+	if (!bundleok(h, len)) {
+		munmap((void *)h, len);
+		return -1;
+	}
+	startupmark(&startup.fontready);
+	return addfont(filename, (void *)h, len, NULL, h);
+}
+
+// SetFont selects the font used by the text functions and new layouts, returning
+// the previously selected font
+int SetFont(int id) {
+	int prev = textfont;
+	if (id >= 0 && id < nfonts) {
+		textfont = id;
+	}
+	return prev;
+}
+
+// FontFallback makes codepoints missing from font id come from font next (-1 to end the chain)
+void FontFallback(int id, int next) {
+	if (id >= 0 && id < nfonts && next < nfonts) {
+		fonts[id].fallback = next;
+		metricsreset();
+	}
+}
+
+// unloadfonts releases every registered font
+static void unloadfonts() {
+	metricsreset();
+	for (int i = 0; i < nfonts; i++) {
+		if (fonts[i].face != NULL) {
+			FT_Done_Face(fonts[i].face);
+		}
+		if (fonts[i].map != NULL) {
+			munmap(fonts[i].map, fonts[i].maplen);
+		}
+		free(fonts[i].path);
+		free(fonts[i].kerns);
+		memset(&sources[i], 0, sizeof(sources[i]));
+	}
+	nfonts = 0;
+	textfont = -1;
+	if (library != NULL) {
+		FT_Done_FreeType(library);
+		library = NULL;
+	}
+}
+
+// bundleglyphs returns the glyph table of a bundle
+static const vgfglyph *bundleglyphs(const vgfheader * b) {
+	return (const vgfglyph *)((const char *)b + b->glyphoffset);
+}
+
+// bundlelookup returns the table position of a codepoint in a bundle, or -1
+static int bundlelookup(const vgfheader * b, unsigned int c) {
+	const vgfglyph *t = bundleglyphs(b);
+	int lo = 0, hi = b->nglyphs - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (t[mid].codepoint < c) {
+			lo = mid + 1;
+		} else if (t[mid].codepoint > c) {
+			hi = mid - 1;
+		} else {
+			return mid;
+		}
+	}
+	return -1;
+}
+
+// bundlecoords returns the coordinates nseg segment commands take, or -1 if a command is unknown
+static long bundlecoords(const VGubyte * segs, uint32_t nseg) {
+	long n = 0;
+	for (uint32_t i = 0; i < nseg; i++) {
+		switch (segs[i] & ~VG_RELATIVE) {
+		case VG_CLOSE_PATH:
+			break;
+		case VG_HLINE_TO:
+		case VG_VLINE_TO:
+			n += 1;
+			break;
+		case VG_MOVE_TO:
+		case VG_LINE_TO:
+		case VG_SQUAD_TO:
+			n += 2;
+			break;
+		case VG_QUAD_TO:
+		case VG_SCUBIC_TO:
+			n += 4;
+			break;
+		case VG_CUBIC_TO:
+			n += 6;
+			break;
+		case VG_SCCWARC_TO:
+		case VG_SCWARC_TO:
+		case VG_LCCWARC_TO:
+		case VG_LCWARC_TO:
+			n += 5;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return n;
+}
+
+// bundleglyph returns the cached glyph for a bundle table entry, building it
+// straight from the mapped segment and coordinate data on a miss
+static glyph *bundleglyph(const vgfheader * b, int i) {
+	const vgfglyph *e = &bundleglyphs(b)[i];
+	glyph *g = glyphfind((void *)b, i);
+
+	if (g != NULL) {
+		return g;
+	}
+	VGPath path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_S_32,
+				   1.0f / 65536.0f, 0.0f, e->nseg, e->ncoord,
+				   VG_PATH_CAPABILITY_ALL);
+	// a glyph whose ranges or commands do not fit the bundle is left empty
+	if (e->nseg > 0 && e->seg <= b->nsegs && e->nseg <= b->nsegs - e->seg
+	    && e->coord <= b->ncoords && e->ncoord <= b->ncoords - e->coord) {
+		const VGubyte *segs = (const VGubyte *)b + b->segoffset + e->seg;
+		const VGint *coords = (const VGint *)((const char *)b + b->coordoffset);
+		long need = bundlecoords(segs, e->nseg);
+		if (need >= 0 && need <= (long)e->ncoord) {
+			vgAppendPathData(path, e->nseg, segs, coords + e->coord);
+		}
+	}
+	return glyphadd((void *)b, i, path, (VGfloat) e->advance / 65536.0f,
+			GLYPHOVERHEAD + e->nseg + (e->ncoord * sizeof(VGint)));
+}
+
+//
+// Glyph metrics
+//
+
+static int kerning = 0;
+static int textmerge = 0;					   // draw strings as one merged path
+
+// bundlemetric fills m from entry i of a bundle's glyph table
+static void bundlemetric(const vgfheader * b, int i, metric * m) {
+	const vgfglyph *e = &bundleglyphs(b)[i];
+
+	m->index = i;
+	m->advance = (VGfloat) e->advance / 65536.0f;
+	m->bbox[0] = (VGfloat) e->minx / 65536.0f;
+	m->bbox[1] = (VGfloat) e->miny / 65536.0f;
+	m->bbox[2] = (VGfloat) e->maxx / 65536.0f;
+	m->bbox[3] = (VGfloat) e->maxy / 65536.0f;
+}
+
+// facemetric fills m from glyph i of a FreeType face, leaving the glyph loaded in its slot
+static int facemetric(FT_Face face, FT_UInt i, metric * m) {
+	FT_BBox box;
+
+	m->index = i;
+	if (FT_Load_Glyph(face, i, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM) != 0) {
+		return 0;
+	}
+	FT_Outline_Get_CBox(&face->glyph->outline, &box);
+	m->advance = (VGfloat) face->glyph->advance.x / 4096.0f;
+	m->bbox[0] = (VGfloat) box.xMin / 4096.0f;
+	m->bbox[1] = (VGfloat) box.yMin / 4096.0f;
+	m->bbox[2] = (VGfloat) box.xMax / 4096.0f;
+	m->bbox[3] = (VGfloat) box.yMax / 4096.0f;
+	return 1;
+}
+
+// fontmetric fills m from font f's glyph for codepoint c; with exact set, a
+// codepoint the font does not map fails rather than using its missing glyph
+static int fontmetric(int f, unsigned int c, int exact, metric * m) {
+	font *fp = &fonts[f];
+
+	if (fp->bundle != NULL) {
+		int i = bundlelookup(fp->bundle, c);
+		m->mapped = i >= 0;
+		if (i < 0 && !exact) {
+			i = bundlelookup(fp->bundle, 0);
+		}
+		if (i < 0) {
+			return 0;
+		}
+		bundlemetric(fp->bundle, i, m);
+	} else {
+		FT_UInt i = FT_Get_Char_Index(fp->face, c);
+		m->mapped = i != 0;
+		if (i == 0 && exact) {
+			return 0;
+		}
+		facemetric(fp->face, i, m);
+	}
+	m->font = f;
+	return 1;
+}
+
+// metricslot returns font f's metric entry for codepoint c, adding its page if needed
+static metric *metricslot(int f, unsigned int c) {
+	metric **pp = &fonts[f].metrics.page[c / METRICPAGE];
+
+	if (*pp == NULL) {
+		*pp = malloc(METRICPAGE * sizeof(metric));
+		for (int i = 0; i < METRICPAGE; i++) {
+			(*pp)[i].index = METRICUNSET;
+		}
+	}
+	return &(*pp)[c % METRICPAGE];
+}
+
+// metricpeek returns font f's metric entry for codepoint c if its page exists
+static metric *metricpeek(int f, unsigned int c) {
+	metric *page = fonts[f].metrics.page[c / METRICPAGE];
+	return page != NULL ? &page[c % METRICPAGE] : NULL;
+}
+
+// fillmetric resolves a codepoint through the selected font's fallback chain,
+// settling on the selected font's missing glyph if no font maps it. This is
+// the only place metrics touch glyph data, and it runs once per codepoint.
+// A fallback that already resolved the codepoint, say from a prewarm, is
+// taken as it is, and fonts still loading in the background are passed over.
+static void fillmetric(unsigned int c, metric * m) {
+	int f = textfont;
+
+	memset(m, 0, sizeof(*m));
+	m->index = METRICNONE;
+	for (int depth = 0; f >= 0 && depth < MAXFONTS; depth++, f = fonts[f].fallback) {
+		if (fonts[f].state != FONTREADY) {
+			continue;
+		}
+		metric *own = f != textfont ? metricpeek(f, c) : NULL;
+		if (own != NULL && own->index >= 0 && own->mapped) {
+			*m = *own;
+			return;
+		}
+		if (fontmetric(f, c, 1, m)) {
+			return;
+		}
+	}
+	if (fonts[textfont].state != FONTREADY || !fontmetric(textfont, c, 0, m)) {
+		m->index = METRICNONE;
+	}
+}
+
+// getmetric returns the metrics of a codepoint in the selected font
+static metric *getmetric(unsigned int c) {
+	static metric none = { .index = METRICNONE };
+
+	if (textfont < 0) {
+		return &none;
+	}
+	if (c >= 0x110000) {
+		c = 0;
+	}
+	// installing the font resets metrics, so wait before taking a slot
+	if (fonts[textfont].state == FONTPENDING) {
+		fontwait(textfont);
+	}
+	metric *m = metricslot(textfont, c);
+	if (m->index == METRICUNSET) {
+		fillmetric(c, m);
+	}
+	return m;
+}
+
+// fontglyph returns the cached glyph path for a glyph index or bundle position of a font
+static glyph *fontglyph(int f, int index) {
+	return fonts[f].bundle != NULL ? bundleglyph(fonts[f].bundle, index) : getglyph(fonts[f].face, index);
+}
+
+// kern returns the unit-size kerning between two glyphs, when kerning is on. Pairs
+// are kept per face in a table indexed by a hash of the two glyphs; a pair that
+// collides with another replaces it.
+static VGfloat kern(metric * left, metric * right) {
+	FT_Vector delta;
+	font *f;
+	kernpair *k;
+
+	if (!kerning || left == NULL || left->index < 0 || right->index < 0 || left->font != right->font) {
+		return 0;
+	}
+	f = &fonts[left->font];
+	if (f->face == NULL || !FT_HAS_KERNING(f->face)) {
+		return 0;
+	}
+	if (f->kerns == NULL) {
+		f->kerns = malloc(KERNPAIRS * sizeof(kernpair));
+		for (int i = 0; i < KERNPAIRS; i++) {
+			f->kerns[i].left = -1;
+		}
+	}
+	k = &f->kerns[(((unsigned int)left->index * 2654435761u) ^ (unsigned int)right->index) % KERNPAIRS];
+	if (k->left != left->index || k->right != right->index) {
+		k->left = left->index;
+		k->right = right->index;
+		k->dx = 0;
+		if (FT_Get_Kerning(f->face, left->index, right->index, FT_KERNING_UNFITTED, &delta) == 0) {
+			k->dx = (VGfloat) delta.x / 4096.0f;
+		}
+	}
+	return k->dx;
+}
+
+// TextKerning turns pair kerning on or off for all text functions
+void TextKerning(int on) {
+	kerning = on;
+}
+
+//
+// Background font loading
+//
+
+// warmglyph is a glyph prepared by the font worker, waiting for the render thread
+typedef struct warmglyph {
+	int font;
+	unsigned int c;
+	metric m;
+	pathbuilder outline;					   // FreeType outlines; bundles build from their mapping
+	struct warmglyph *next;
+} warmglyph;
+
+// fontjob is a font load or prewarm waiting for the worker
+typedef struct fontjob {
+	int font;
+	unsigned int *codes;					   // codepoints to prewarm, NULL to load the font
+	int n;
+	struct fontjob *next;
+} fontjob;
+
+#define WARMBUDGET 256						   // prewarmed glyphs handed over per frame
+
+static pthread_t worker;
+static pthread_cond_t workcond = PTHREAD_COND_INITIALIZER;	   // a job was queued, or the worker should stop
+static pthread_cond_t loadcond = PTHREAD_COND_INITIALIZER;	   // a background load finished
+static int workstarted, workquit, workbusy;
+static fontjob *jobhead, *jobtail;
+static warmglyph *readyhead, *readytail;
+static int prewarming;						   // prewarm jobs queued and not yet handed over
+static struct timespec startclock;
+
+// startupmark records the time since init() began in *t, unless already recorded;
+// NULL starts the clock
+static void startupmark(double *t) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (t == NULL) {
+		startclock = now;
+	} else if (*t == 0) {
+		*t = (now.tv_sec - startclock.tv_sec) + (now.tv_nsec - startclock.tv_nsec) / 1e9;
+	}
+}
+
+// StartupInfo reports startup timings and prewarm progress
+void StartupInfo(StartupStats * s) {
+	*s = startup;
+}
+
+// loadsource maps and opens a font on the worker, as a bundle if it is one and
+// as a FreeType face otherwise, asking the kernel to read the file ahead
+static void loadsource(int id) {
+	fontsource *src = &sources[id];
+	void *map;
+	size_t len;
+	const vgfheader *bundle = NULL;
+	FT_Face face = NULL;
+	int ok = 0;
+
+	if ((map = mapfile(src->path, &len)) != NULL) {
+		madvise(map, len, MADV_WILLNEED);
+		if (bundleok(map, len)) {
+			bundle = map;
+			ok = 1;
+		} else {
+			pthread_mutex_lock(&ftlock);
+			ok = FT_New_Memory_Face(library, map, len, 0, &face) == 0;
+			pthread_mutex_unlock(&ftlock);
+			if (ok) {
+				FT_Set_Char_Size(face, 0, 64 * 64, 96, 96);
+			} else {
+				munmap(map, len);
+			}
+		}
+	}
+	pthread_mutex_lock(&worklock);
+	if (ok) {
+		src->map = map;
+		src->len = len;
+		src->bundle = bundle;
+		src->face = face;
+	}
+	src->state = ok ? LOADDONE : LOADFAILED;
+	pthread_cond_broadcast(&loadcond);
+	pthread_mutex_unlock(&worklock);
+}
+
+// codecmp orders codepoints
+static int codecmp(const void *a, const void *b) {
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return x < y ? -1 : x > y;
+}
+
+// prewarm prepares the metrics and outlines of a set of codepoints on the worker,
+// using a face of its own, and queues each glyph for the render thread
+static void prewarm(fontjob * j) {
+	fontsource *src = &sources[j->font];
+	int state;
+
+	pthread_mutex_lock(&worklock);
+	state = src->state;
+	pthread_mutex_unlock(&worklock);
+	if (state != LOADDONE && state != LOADINSTALLED) {
+		return;
+	}
+	if (src->bundle == NULL && src->warm == NULL) {
+		pthread_mutex_lock(&ftlock);
+		if (FT_New_Memory_Face(library, src->map, src->len, 0, &src->warm) == 0) {
+			FT_Set_Char_Size(src->warm, 0, 64 * 64, 96, 96);
+		} else {
+			src->warm = NULL;
+		}
+		pthread_mutex_unlock(&ftlock);
+		if (src->warm == NULL) {
+			return;
+		}
+	}
+	qsort(j->codes, j->n, sizeof(unsigned int), codecmp);
+	for (int k = 0, quit = 0; k < j->n && !quit; k++) {
+		unsigned int c = j->codes[k];
+		if (k > 0 && c == j->codes[k - 1]) {
+			continue;
+		}
+		warmglyph *w = calloc(1, sizeof(warmglyph));
+		w->font = j->font;
+		w->c = c;
+		w->m.font = j->font;
+		w->m.mapped = 1;
+		if (src->bundle != NULL) {
+			int i = bundlelookup(src->bundle, c);
+			if (i < 0) {
+				free(w);
+				continue;
+			}
+			bundlemetric(src->bundle, i, &w->m);
+			// fault the outline in here rather than on the render thread
+			const vgfglyph *e = &bundleglyphs(src->bundle)[i];
+			if (e->coord + e->ncoord <= src->bundle->ncoords) {
+				const volatile int32_t *coords = (const int32_t *)((const char *)src->bundle + src->bundle->coordoffset);
+				for (uint32_t off = 0; off < e->ncoord; off += 1024) {
+					(void)coords[e->coord + off];
+				}
+			}
+		} else {
+			FT_UInt i = FT_Get_Char_Index(src->warm, c);
+			if (i == 0 || !facemetric(src->warm, i, &w->m)) {
+				free(w);
+				continue;
+			}
+			outlinepath(&w->outline, &src->warm->glyph->outline);
+		}
+		pthread_mutex_lock(&worklock);
+		if (readytail != NULL) {
+			readytail->next = w;
+		} else {
+			readyhead = w;
+		}
+		readytail = w;
+		quit = workquit;
+		pthread_mutex_unlock(&worklock);
+	}
+}
+
+// fontworker runs queued font loads and prewarms in order
+static void *fontworker(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&worklock);
+	for (;;) {
+		while (jobhead == NULL && !workquit) {
+			pthread_cond_wait(&workcond, &worklock);
+		}
+		if (workquit) {
+			break;
+		}
+		fontjob *j = jobhead;
+		jobhead = j->next;
+		if (jobhead == NULL) {
+			jobtail = NULL;
+		}
+		workbusy = 1;
+		pthread_mutex_unlock(&worklock);
+		if (j->codes == NULL) {
+			loadsource(j->font);
+		} else {
+			prewarm(j);
+		}
+		free(j->codes);
+		free(j);
+		pthread_mutex_lock(&worklock);
+		workbusy = 0;
+	}
+	pthread_mutex_unlock(&worklock);
+	return NULL;
+}
+
+// fontqueue hands a job to the worker, starting it on first use
+static void fontqueue(int id, unsigned int *codes, int n) {
+	fontjob *j = calloc(1, sizeof(fontjob));
+
+	j->font = id;
+	j->codes = codes;
+	j->n = n;
+	pthread_mutex_lock(&worklock);
+	if (!workstarted) {
+		workquit = 0;
+		workstarted = pthread_create(&worker, NULL, fontworker, NULL) == 0;
+	}
+	if (jobtail != NULL) {
+		jobtail->next = j;
+	} else {
+		jobhead = j;
+	}
+	jobtail = j;
+	if (codes != NULL) {
+		prewarming++;
+	}
+	pthread_cond_signal(&workcond);
+	pthread_mutex_unlock(&worklock);
+}
+
+// fontpoll installs the fonts the worker has finished loading. Metrics resolved
+// while a font was loading are forgotten if it is selected or in a fallback chain.
+static void fontpoll() {
+	int reset = 0;
+
+	if (!workstarted) {
+		return;
+	}
+	pthread_mutex_lock(&worklock);
+	for (int id = 0; id < nfonts; id++) {
+		fontsource *src = &sources[id];
+		if (fonts[id].state != FONTPENDING || src->state == LOADPENDING) {
+			continue;
+		}
+		if (src->state == LOADDONE) {
+			fonts[id].map = src->map;
+			fonts[id].maplen = src->len;
+			fonts[id].face = src->face;
+			fonts[id].bundle = src->bundle;
+			fonts[id].state = FONTREADY;
+			src->state = LOADINSTALLED;
+			startupmark(&startup.fontready);
+		} else {
+			fonts[id].state = FONTFAILED;
+		}
+		reset |= id == textfont;
+		for (int f = 0; f < nfonts; f++) {
+			reset |= fonts[f].fallback == id;
+		}
+	}
+	pthread_mutex_unlock(&worklock);
+	if (reset) {
+		metricsreset();
+	}
+}
+
+// fontwait blocks until a font loading in the background is usable or has failed
+static void fontwait(int id) {
+	pthread_mutex_lock(&worklock);
+	while (sources[id].state == LOADPENDING && workstarted) {
+		pthread_cond_wait(&loadcond, &worklock);
+	}
+	pthread_mutex_unlock(&worklock);
+	fontpoll();
+}
+
+// warmdrain hands over up to budget prewarmed glyphs to the render thread: their
+// metrics go into their font's table and their paths into the glyph cache
+static void warmdrain(int budget) {
+	warmglyph *list, *w;
+	int n = 0, done;
+
+	if (!workstarted) {
+		return;
+	}
+	pthread_mutex_lock(&worklock);
+	list = readyhead;
+	for (w = readyhead; w != NULL && n < budget - 1; w = w->next) {
+		n++;
+	}
+	if (w != NULL) {
+		readyhead = w->next;
+		w->next = NULL;
+	} else {
+		readyhead = NULL;
+	}
+	if (readyhead == NULL) {
+		readytail = NULL;
+	}
+	done = readyhead == NULL && jobhead == NULL && !workbusy;
+	pthread_mutex_unlock(&worklock);
+
+	while (list != NULL) {
+		w = list;
+		list = w->next;
+		font *fp = &fonts[w->font];
+		if (fp->state == FONTREADY) {
+			metric *m = metricslot(w->font, w->c);
+			if (m->index == METRICUNSET) {
+				*m = w->m;
+			}
+			if (fp->bundle != NULL) {
+				if (!glyphcached((void *)fp->bundle, w->m.index)) {
+					bundleglyph(fp->bundle, w->m.index);
+				}
+			} else if (!glyphcached(fp->face, w->m.index)) {
+				unsigned long bytes;
+				VGPath path = pbpath(&w->outline, &bytes);
+				glyphadd(fp->face, w->m.index, path, w->m.advance, bytes);
+			}
+			startup.glyphs++;
+		}
+		free(w->outline.segs);
+		free(w->outline.coords);
+		free(w);
+	}
+	if (done && prewarming > 0) {
+		prewarming = 0;
+		startup.prewarmed = 0;
+		startupmark(&startup.prewarmed);
+	}
+}
+
+// stopworker stops the font worker, installing the fonts it finished and
+// dropping work it has not handed over
+static void stopworker() {
+	if (!workstarted) {
+		return;
+	}
+	pthread_mutex_lock(&worklock);
+	workquit = 1;
+	pthread_cond_signal(&workcond);
+	pthread_mutex_unlock(&worklock);
+	pthread_join(worker, NULL);
+	fontpoll();
+	workstarted = 0;
+	while (jobhead != NULL) {
+		fontjob *j = jobhead;
+		jobhead = j->next;
+		free(j->codes);
+		free(j);
+	}
+	jobtail = NULL;
+	while (readyhead != NULL) {
+		warmglyph *w = readyhead;
+		readyhead = w->next;
+		free(w->outline.segs);
+		free(w->outline.coords);
+		free(w);
+	}
+	readytail = NULL;
+	prewarming = 0;
+	for (int i = 0; i < nfonts; i++) {
+		if (sources[i].warm != NULL) {
+			FT_Done_Face(sources[i].warm);
+			sources[i].warm = NULL;
+		}
+	}
+	pthread_cond_broadcast(&loadcond);
+}
+
+// LoadFontAsync registers a font, bundle or FreeType, and returns its id at once
+// while a worker thread maps and opens it. Text in the font waits for the load
+// on first use; as a fallback, the font is passed over until it is ready.
+int LoadFontAsync(char *filename) {
+	int id = findfont(filename);
+
+	if (id >= 0) {
+		return id;
+	}
+	if (nfonts == MAXFONTS || access(filename, R_OK) != 0) {
+		return -1;
+	}
+	if (library == NULL && FT_Init_FreeType(&library) != 0) {
+		return -1;
+	}
+	id = addfont(filename, NULL, 0, NULL, NULL);
+	fonts[id].state = FONTPENDING;
+	pthread_mutex_lock(&worklock);
+	sources[id].state = LOADPENDING;
+	pthread_mutex_unlock(&worklock);
+	fontqueue(id, NULL, 0);
+	return id;
+}
+
+// FontPrewarm has the worker prepare the metrics and outlines of every codepoint
+// in s for font id; the glyphs are handed over a few hundred per frame in End().
+// Prewarming more glyphs than the glyph cache holds keeps only the latest paths.
+void FontPrewarm(int id, char *s) {
+	int n = strlen(s);
+
+	if (id >= 0 && id < nfonts && n > 0) {
+		unsigned int *codes = malloc(n * sizeof(unsigned int));
+		fontqueue(id, codes, utf8decode(s, n, codes));
+	}
+}
+
+// FontPrewarmRange prewarms the codepoints first to last of font id that it maps
+void FontPrewarmRange(int id, unsigned int first, unsigned int last) {
+	if (last > 0x10FFFF) {
+		last = 0x10FFFF;
+	}
+	if (id >= 0 && id < nfonts && first <= last) {
+		int n = last - first + 1;
+		unsigned int *codes = malloc(n * sizeof(unsigned int));
+		for (int i = 0; i < n; i++) {
+			codes[i] = first + i;
+		}
+		fontqueue(id, codes, n);
+	}
+}
+
+//
+// Glyph atlas
+//
+
+// atlasglyph is a glyph rasterized at one pixel size, stored in an atlas page
+typedef struct atlasglyph {
+	FT_Face face;
+	unsigned int index;
+	int size;						   // point size the glyph was rasterized for
+	VGImage image;						   // child image of the page; invalid for blank glyphs
+	int left, top;						   // bitmap offset from the pen position, in pixels
+	int w, h;
+	struct atlasglyph *hnext;				   // next in hash chain
+	struct atlasglyph *pnext;				   // next on the same page
+} atlasglyph;
+
+// atlaspage is an alpha image holding glyphs of one size, packed in shelves
+typedef struct {
+	VGImage image;
+	int size;
+	int x, y, shelf;					   // packing cursor and current shelf height
+	unsigned long used;					   // last use, for LRU eviction
+	atlasglyph *glyphs;
+} atlaspage;
+
+#define ATLASPAGE	512					   // page width and height, in pixels
+#define ATLASBUCKETS	1024
+
+static atlaspage *atlaspages;
+static int natlaspages;
+static int atlasmaxpages = 8;
+static int atlasmax = 0;					   // largest point size drawn from the atlas, 0 for off
+static unsigned long atlasclock;
+static atlasglyph *atlastab[ATLASBUCKETS];
+
+// atlashash hashes an atlas key
+static unsigned int atlashash(FT_Face face, unsigned int index, int size) {
+	return ((unsigned int)((uintptr_t) face >> 4) * 31 + (index * 67) + size) & (ATLASBUCKETS - 1);
+}
+
+// atlasclear empties a page, destroying its glyph images and forgetting their entries
+static void atlasclear(atlaspage * p) {
+	atlasglyph *a, *next;
+
+	for (a = p->glyphs; a != NULL; a = next) {
+		atlasglyph **pp = &atlastab[atlashash(a->face, a->index, a->size)];
+		while (*pp != a)
+			pp = &(*pp)->hnext;
+		*pp = a->hnext;
+		if (a->image != VG_INVALID_HANDLE) {
+			vgDestroyImage(a->image);
+		}
+		next = a->pnext;
+		free(a);
+	}
+	p->glyphs = NULL;
+	p->x = p->y = p->shelf = 0;
+}
+
+// atlasflush destroys every atlas page
+static void atlasflush() {
+	for (int i = 0; i < natlaspages; i++) {
+		atlasclear(&atlaspages[i]);
+		vgDestroyImage(atlaspages[i].image);
+	}
+	free(atlaspages);
+	atlaspages = NULL;
+	natlaspages = 0;
+}
+
+// atlasfit reserves a w x h cell on page p, returning 0 if the page is full
+static int atlasfit(atlaspage * p, int w, int h, int *x, int *y) {
+	if (p->x + w > ATLASPAGE) {
+		p->x = 0;
+		p->y += p->shelf;
+		p->shelf = 0;
+	}
+	if (p->y + h > ATLASPAGE || w > ATLASPAGE) {
+		return 0;
+	}
+	*x = p->x;
+	*y = p->y;
+	p->x += w;
+	if (h > p->shelf) {
+		p->shelf = h;
+	}
+	return 1;
+}
+
+// atlasplace finds room for a w x h bitmap of the given size, adding a page or
+// recycling the least recently used one when needed
+static atlaspage *atlasplace(int size, int w, int h, int *x, int *y) {
+	atlaspage *p, *lru = NULL;
+	int i;
+
+	for (i = 0; i < natlaspages; i++) {
+		p = &atlaspages[i];
+		if (p->size == size && atlasfit(p, w, h, x, y)) {
+			return p;
+		}
+		if (lru == NULL || p->used < lru->used) {
+			lru = p;
+		}
+	}
+	if (natlaspages < atlasmaxpages) {
+		atlaspages = realloc(atlaspages, (natlaspages + 1) * sizeof(atlaspage));
+		p = &atlaspages[natlaspages++];
+		memset(p, 0, sizeof(*p));
+		p->image = vgCreateImage(VG_A_8, ATLASPAGE, ATLASPAGE, VG_IMAGE_QUALITY_NONANTIALIASED);
+	} else if (lru != NULL) {
+		p = lru;
+		atlasclear(p);
+	} else {
+		return NULL;
+	}
+	p->size = size;
+	p->used = ++atlasclock;
+	return atlasfit(p, w, h, x, y) ? p : NULL;
+}
+
+// atlasfind returns a glyph rasterized for a point size, rasterizing it on a miss;
+// NULL if it cannot be placed
+static atlasglyph *atlasfind(FT_Face face, unsigned int index, int size) {
+	unsigned int h = atlashash(face, index, size);
+	atlasglyph *a;
+	atlaspage *p;
+	int x, y;
+
+	for (a = atlastab[h]; a != NULL; a = a->hnext) {
+		if (a->face == face && a->index == index && a->size == size) {
+			return a;
+		}
+	}
+	if (FT_Load_Glyph(face, index, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM) != 0) {
+		return NULL;
+	}
+	// outlines are loaded at 64 points; scale to the requested size and render
+	FT_Fixed scale = ((FT_Fixed) size << 16) / 64;
+	FT_Matrix m = { scale, 0, 0, scale };
+	FT_Outline_Transform(&face->glyph->outline, &m);
+	if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL) != 0) {
+		return NULL;
+	}
+	FT_Bitmap *bm = &face->glyph->bitmap;
+
+	a = calloc(1, sizeof(atlasglyph));
+	a->face = face;
+	a->index = index;
+	a->size = size;
+	a->left = face->glyph->bitmap_left;
+	a->top = face->glyph->bitmap_top;
+	a->w = bm->width;
+	a->h = bm->rows;
+	if (a->w > 0 && a->h > 0) {
+		// a pixel of padding keeps neighbours out of filtered edges
+		if ((p = atlasplace(size, a->w + 1, a->h + 1, &x, &y)) == NULL) {
+			free(a);
+			return NULL;
+		}
+		// FreeType rows run top down, VG image rows bottom up
+		vgImageSubData(p->image, bm->buffer + (bm->rows - 1) * bm->pitch, -bm->pitch, VG_A_8, x, y, a->w, a->h);
+		a->image = vgChildImage(p->image, x, y, a->w, a->h);
+	} else {
+		// blank glyphs are recorded on any page of the size, so they are evicted with it
+		if ((p = atlasplace(size, 0, 0, &x, &y)) == NULL) {
+			free(a);
+			return NULL;
+		}
+	}
+	a->pnext = p->glyphs;
+	p->glyphs = a;
+	a->hnext = atlastab[h];
+	atlastab[h] = a;
+	return a;
+}
+
+// atlastouch marks the page holding glyphs of a size as recently used
+static void atlastouch(int size) {
+	atlasclock++;
+	for (int i = 0; i < natlaspages; i++) {
+		if (atlaspages[i].size == size) {
+			atlaspages[i].used = atlasclock;
+		}
+	}
+}
+
+// TextAtlas draws text at or below maxsize points from glyphs rasterized once into
+// alpha atlas pages (0 turns this off), keeping at most maxpages pages of
+// ATLASPAGE x ATLASPAGE pixels, least recently used pages being recycled first.
+// Only FreeType fonts are rasterized; bundle glyphs are still drawn as outlines.
+void TextAtlas(int maxsize, int maxpages) {
+	atlasmax = maxsize;
+	if (maxpages > 0) {
+		atlasmaxpages = maxpages;
+	}
+	while (natlaspages > atlasmaxpages) {
+		atlaspage *p = &atlaspages[--natlaspages];
+		atlasclear(p);
+		vgDestroyImage(p->image);
+	}
+}
+
+//
+// Text layout
+//
+
+// placedglyph is a glyph positioned along the baseline, at unit size
+typedef struct {
+	int font;
+	int index;						   // glyph index or bundle position
+	VGfloat x;
+} placedglyph;
+
+// textlayout is a string decoded, mapped to glyphs and positioned once, for drawing many times
+struct textlayout {
+	char *text;
+	int len;
+	int font;						   // font, font generation and kerning
+	unsigned int gen;					   // the layout was made with
+	int kerned;
+	placedglyph *glyphs;
+	int n, cap;
+	VGfloat width;						   // advance width, at unit size
+	VGfloat bbox[4];					   // ink box x, y, width, height, at unit size
+	VGPath merged;						   // all glyphs in one path, made on demand
+};
+
+static struct textlayout scratch;				   // reused by the one-shot text functions
+
+// layout decodes n bytes of s and positions their glyphs in l, reusing l's glyph buffer
+static void layout(struct textlayout *l, const char *s, int n) {
+	VGfloat xx = 0.0f, minx = 0.0f, miny = 0.0f, maxx = 0.0f, maxy = 0.0f;
+	metric *prev = NULL;
+	int inked = 0, nc = decode(s, n);
+
+	l->n = 0;
+	l->font = textfont;
+	l->gen = fontgen;
+	l->kerned = kerning;
+	for (int i = 0; i < nc; i++) {
+		metric *m = getmetric(codebuf[i]);
+		xx += kern(prev, m);
+		prev = m;
+		if (m->index < 0) {
+			continue;
+		}
+		if (l->n == l->cap) {
+			l->cap = l->cap ? l->cap * 2 : 64;
+			l->glyphs = realloc(l->glyphs, l->cap * sizeof(placedglyph));
+		}
+		l->glyphs[l->n].font = m->font;
+		l->glyphs[l->n].index = m->index;
+		l->glyphs[l->n].x = xx;
+		l->n++;
+		if (m->bbox[2] > m->bbox[0] && m->bbox[3] > m->bbox[1]) {
+			if (!inked || xx + m->bbox[0] < minx)
+				minx = xx + m->bbox[0];
+			if (!inked || xx + m->bbox[2] > maxx)
+				maxx = xx + m->bbox[2];
+			if (!inked || m->bbox[1] < miny)
+				miny = m->bbox[1];
+			if (!inked || m->bbox[3] > maxy)
+				maxy = m->bbox[3];
+			inked = 1;
+		}
+		xx += m->advance;
+	}
+	l->width = xx;
+	l->bbox[0] = minx;
+	l->bbox[1] = miny;
+	l->bbox[2] = maxx - minx;
+	l->bbox[3] = maxy - miny;
+}
+
+// relayout refreshes a layout made before its font's fallbacks or the kerning changed
+static struct textlayout *relayout(struct textlayout *l) {
+	if (l->gen != fontgen || l->kerned != kerning) {
+		int selected = SetFont(l->font);
+		layout(l, l->text, l->len);
+		SetFont(selected);
+		if (l->merged != VG_INVALID_HANDLE) {
+			vgDestroyPath(l->merged);
+			l->merged = VG_INVALID_HANDLE;
+		}
+	}
+	return l;
+}
+
+// mergelayout builds one path holding every glyph of a layout, with the
+// glyph offsets baked into its coordinates by vgTransformPath
+static VGPath mergelayout(struct textlayout *l) {
+	VGPath path = vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F, 1.0f, 0.0f, 0, 0,
+				   VG_PATH_CAPABILITY_ALL);
+
+	for (int i = 0; i < l->n; i++) {
+		VGfloat mat[9] = {
+			1.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f,
+			l->glyphs[i].x, 0.0f, 1.0f
+		};
+		loadmatrix(VG_MATRIX_PATH_USER_TO_SURFACE, mat);
+		vgTransformPath(path, fontglyph(l->glyphs[i].font, l->glyphs[i].index)->path);
+	}
+	return path;
+}
+
+// drawmerged draws a merged text path with its start at (x,y)
+static void drawmerged(VGPath path, VGfloat x, VGfloat y, int pointsize) {
+	drawplaced(path, (VGfloat) pointsize, x, y, VG_FILL_PATH);
+}
+
+// drawatlas draws a layout with its start at (x,y) from atlas glyphs, stencilling
+// the fill paint through them. Glyphs that cannot be rasterized are drawn as outlines.
+static void drawatlas(struct textlayout *l, VGfloat x, VGfloat y, int pointsize) {
+	VGfloat size = (VGfloat) pointsize;
+
+	setint(VG_IMAGE_MODE, VG_DRAW_IMAGE_STENCIL);
+	for (int i = 0; i < l->n; i++) {
+		placedglyph *pg = &l->glyphs[i];
+		FT_Face ft = fonts[pg->font].face;
+		atlasglyph *a = ft != NULL ? atlasfind(ft, pg->index, pointsize) : NULL;
+		VGfloat px = floorf(x + (size * pg->x) + 0.5f), py = floorf(y + 0.5f);
+
+		if (a == NULL) {
+			drawplaced(fontglyph(pg->font, pg->index)->path, size, x + (size * pg->x), y, VG_FILL_PATH);
+		} else if (a->image != VG_INVALID_HANDLE) {
+			drawimageat(a->image, px + a->left, py + a->top - a->h);
+		}
+	}
+	atlastouch(pointsize);
+	setint(VG_IMAGE_MODE, VG_DRAW_IMAGE_NORMAL);
+}
+
+// atlasok reports whether text of a size under the current transform should come from the
+// atlas: bitmaps only look right when the transform does not scale, rotate or shear them
+static int atlasok(int pointsize) {
+	const VGfloat *mm = matrixstack[matrixtop];
+	return atlasmax > 0 && pointsize <= atlasmax && mm[0] == 1.0f && mm[4] == 1.0f
+	    && mm[1] == 0.0f && mm[3] == 0.0f && mm[2] == 0.0f && mm[5] == 0.0f;
+}
+
+// inkculled reports whether text with the ink box b at unit size, drawn with its start
+// at (x,y), misses the view. The pad covers atlas bitmaps snapped to whole pixels.
+static int inkculled(const VGfloat b[4], VGfloat x, VGfloat y, int pointsize) {
+	return culled(x + (b[0] * pointsize), y + (b[1] * pointsize), b[2] * pointsize, b[3] * pointsize, 1.0f);
+}
+
+// fontreach sets r to font f's widest advance and the minx, miny, maxx, maxy of all
+// its glyphs at unit size, working them out on first use; it fails for fonts not ready
+static int fontreach(int f, VGfloat r[5]) {
+	font *fp = &fonts[f];
+
+	if (fp->state != FONTREADY) {
+		return 0;
+	}
+	if (!fp->reached) {
+		if (fp->bundle != NULL) {
+			const vgfglyph *g = bundleglyphs(fp->bundle);
+			VGfloat b[5] = { 0, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t i = 0; i < fp->bundle->nglyphs; i++) {
+				b[0] = fmaxf(b[0], g[i].advance);
+				b[1] = fminf(b[1], g[i].minx);
+				b[2] = fminf(b[2], g[i].miny);
+				b[3] = fmaxf(b[3], g[i].maxx);
+				b[4] = fmaxf(b[4], g[i].maxy);
+			}
+			for (int i = 0; i < 5; i++) {
+				fp->reach[i] = fp->bundle->nglyphs > 0 ? b[i] / 65536.0f : 0.0f;
+			}
+		} else {
+			FT_Face ft = fp->face;
+			FT_Fixed xs = ft->size->metrics.x_scale, ys = ft->size->metrics.y_scale;
+			fp->reach[0] = FT_MulFix(ft->max_advance_width, xs) / 4096.0f;
+			fp->reach[1] = FT_MulFix(ft->bbox.xMin, xs) / 4096.0f;
+			fp->reach[2] = FT_MulFix(ft->bbox.yMin, ys) / 4096.0f;
+			fp->reach[3] = FT_MulFix(ft->bbox.xMax, xs) / 4096.0f;
+			fp->reach[4] = FT_MulFix(ft->bbox.yMax, ys) / 4096.0f;
+		}
+		fp->reached = 1;
+	}
+	memcpy(r, fp->reach, sizeof(fp->reach));
+	return 1;
+}
+
+// reachculled reports whether n bytes of text in the selected font, drawn at x - (anchor *
+// width), y, surely miss the view, before anything is decoded or looked up. Each byte is
+// taken as the widest glyph of any font in the fallback chain; with kerning, as two.
+static int reachculled(VGfloat x, VGfloat y, int n, int pointsize, VGfloat anchor) {
+	VGfloat r[5] = { 0, 0, 0, 0, 0 }, fr[5], v[4];
+	int f = textfont;
+
+	for (int k = 0; f >= 0 && k < MAXFONTS; k++, f = fonts[f].fallback) {
+		if (!fontreach(f, fr)) {
+			return 0;
+		}
+		r[0] = fmaxf(r[0], fr[0]);
+		for (int i = 1; i < 3; i++) {
+			r[i] = fminf(r[i], fr[i]);
+			r[i + 2] = fmaxf(r[i + 2], fr[i + 2]);
+		}
+	}
+	if (f >= 0) {
+		return 0;
+	}
+	VGfloat w = n * r[0] * pointsize, slack = kerning ? w : 0.0f;
+	VGfloat x0 = x - (anchor * w) - slack + (r[1] * pointsize), x1 = x + w + slack + (r[3] * pointsize);
+	viewbox(v, 1);
+	if (outside(v, matrixstack[matrixtop], x0, y + (r[2] * pointsize), x1 - x0, (r[4] - r[2]) * pointsize, 1.0f)) {
+		statecount.culled++;
+		return 1;
+	}
+	return 0;
+}
+
+// drawlayout draws a layout with its start at (x,y)
+static void drawlayout(struct textlayout *l, VGfloat x, VGfloat y, int pointsize) {
+	VGfloat size = (VGfloat) pointsize;
+
+	if (inkculled(l->bbox, x, y, pointsize)) {
+		return;
+	}
+	if (atlasok(pointsize)) {
+		drawatlas(l, x, y, pointsize);
+		return;
+	}
+	if (textmerge && l != &scratch) {
+		if (l->merged == VG_INVALID_HANDLE) {
+			l->merged = mergelayout(l);
+		}
+		drawmerged(l->merged, x, y, pointsize);
+		return;
+	}
+	for (int i = 0; i < l->n; i++) {
+		glyph *g = fontglyph(l->glyphs[i].font, l->glyphs[i].index);
+		drawplaced(g->path, size, x + (size * l->glyphs[i].x), y, VG_FILL_PATH);
+	}
+}
+
+// newlayout makes a layout holding its own copy of n bytes of s
+static struct textlayout *newlayout(const char *s, int n) {
+	struct textlayout *l = calloc(1, sizeof(struct textlayout));
+	l->text = malloc(n + 1);
+	memcpy(l->text, s, n);
+	l->text[n] = '\0';
+	l->len = n;
+	layout(l, l->text, l->len);
+	return l;
+}
+
+// NewTextLayout decodes, maps and positions a string once, for repeated drawing
+TextLayout NewTextLayout(char *s) {
+	return newlayout(s, strlen(s));
+}
+
+// DeleteTextLayout frees a text layout
+void DeleteTextLayout(TextLayout l) {
+	if (l != NULL) {
+		if (l->merged != VG_INVALID_HANDLE) {
+			vgDestroyPath(l->merged);
+		}
+		free(l->text);
+		free(l->glyphs);
+		free(l);
+	}
+}
+
+// TextLayoutDraw draws a text layout with its start at (x,y)
+void TextLayoutDraw(TextLayout l, VGfloat x, VGfloat y, int pointsize) {
+	drawlayout(relayout(l), x, y, pointsize);
+}
+
+// TextLayoutMid draws a text layout, centered on (x,y)
+void TextLayoutMid(TextLayout l, VGfloat x, VGfloat y, int pointsize) {
+	relayout(l);
+	drawlayout(l, x - (l->width * pointsize / 2.0f), y, pointsize);
+}
+
+// TextLayoutEnd draws a text layout, with its end aligned to (x,y)
+void TextLayoutEnd(TextLayout l, VGfloat x, VGfloat y, int pointsize) {
+	relayout(l);
+	drawlayout(l, x - (l->width * pointsize), y, pointsize);
+}
+
+// TextLayoutWidth returns the width of a text layout at the specified size
+VGfloat TextLayoutWidth(TextLayout l, int pointsize) {
+	return relayout(l)->width * pointsize;
+}
+
+// TextLayoutBBox returns the ink bounding box of a text layout drawn at (0,0) as x, y, width, height
+void TextLayoutBBox(TextLayout l, int pointsize, VGfloat box[4]) {
+	relayout(l);
+	for (int i = 0; i < 4; i++) {
+		box[i] = l->bbox[i] * pointsize;
+	}
+}
+
+//
+// Merged string cache
+//
+
+// mergedtext is a string drawn as a single path, kept for reuse
+typedef struct {
+	char *text;
+	int len;
+	unsigned int hash;
+	int font;
+	unsigned int gen;
+	int kerned;
+	VGPath path;						   // made when first drawn
+	VGfloat width;						   // advance width, at unit size
+	VGfloat bbox[4];					   // ink box, at unit size
+	unsigned long used;					   // last use, for LRU replacement
+} mergedtext;
+
+#define MERGECACHE 64
+
+static mergedtext mergecache[MERGECACHE];
+static unsigned long mergeclock;
+
+// strhash hashes n bytes of a string (FNV-1a)
+static unsigned int strhash(const char *s, int n) {
+	unsigned int h = 2166136261u;
+	while (n-- > 0) {
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	}
+	return h;
+}
+
+// getmerged returns the cache entry of n bytes of text in the current font, laying
+// it out into scratch on a miss; laid says whether it did
+static mergedtext *getmerged(const char *s, int n, int *laid) {
+	unsigned int h = strhash(s, n);
+	mergedtext *m, *victim = &mergecache[0];
+
+	for (m = mergecache; m < mergecache + MERGECACHE; m++) {
+		if (m->text != NULL && m->hash == h && m->len == n && m->font == textfont && m->gen == fontgen
+		    && m->kerned == kerning
+		    && memcmp(m->text, s, n) == 0) {
+			m->used = ++mergeclock;
+			*laid = 0;
+			return m;
+		}
+		if (m->used < victim->used) {
+			victim = m;
+		}
+	}
+	m = victim;
+	if (m->text != NULL) {
+		free(m->text);
+		if (m->path != VG_INVALID_HANDLE) {
+			vgDestroyPath(m->path);
+		}
+	}
+	layout(&scratch, s, n);
+	m->text = malloc(n > 0 ? n : 1);
+	memcpy(m->text, s, n);
+	m->len = n;
+	m->hash = h;
+	m->font = textfont;
+	m->gen = fontgen;
+	m->kerned = kerning;
+	m->path = VG_INVALID_HANDLE;
+	m->width = scratch.width;
+	memcpy(m->bbox, scratch.bbox, sizeof(m->bbox));
+	m->used = ++mergeclock;
+	*laid = 1;
+	return m;
+}
+
+// mergeflush destroys all cached merged strings
+static void mergeflush() {
+	for (mergedtext * m = mergecache; m < mergecache + MERGECACHE; m++) {
+		if (m->text != NULL) {
+			free(m->text);
+			if (m->path != VG_INVALID_HANDLE) {
+				vgDestroyPath(m->path);
+			}
+		}
+		memset(m, 0, sizeof(*m));
+	}
+}
+
+// TextMerge selects drawing each string or layout as one merged path (on),
+// rather than one path per glyph (off). Merged strings are cached.
+void TextMerge(int on) {
+	textmerge = on;
+}
+
+// textat draws n bytes of text with its start at x - (anchor * width), y
+static void textat(VGfloat x, VGfloat y, const char *s, int n, int pointsize, VGfloat anchor) {
+	if (reachculled(x, y, n, pointsize, anchor)) {
+		return;
+	}
+	if (textmerge && !(atlasmax > 0 && pointsize <= atlasmax)) {
+		int laid;
+		mergedtext *m = getmerged(s, n, &laid);
+		x -= anchor * m->width * pointsize;
+		if (inkculled(m->bbox, x, y, pointsize)) {
+			return;
+		}
+		if (m->path == VG_INVALID_HANDLE) {
+			if (!laid) {
+				layout(&scratch, s, n);
+			}
+			m->path = mergelayout(&scratch);
+		}
+		drawmerged(m->path, x, y, pointsize);
+		return;
+	}
+	layout(&scratch, s, n);
+	drawlayout(&scratch, x - (anchor * scratch.width * pointsize), y, pointsize);
+}
+
+// textwidth measures n bytes of text at unit size
+static VGfloat textwidth(const char *s, int n) {
+	VGfloat tw = 0.0;
+	metric *prev = NULL;
+	int nc = decode(s, n);
+	for (int i = 0; i < nc; i++) {
+		metric *m = getmetric(codebuf[i]);
+		tw += kern(prev, m) + m->advance;
+		prev = m;
+	}
+	return tw;
+}
+
+// Text draws text, with its start at (x,y)
+void Text(VGfloat x, VGfloat y, char *s, int pointsize) {
+	textat(x, y, s, strlen(s), pointsize, 0.0f);
+}
+
+// TextN draws the first n bytes of s, which need not be terminated, with its start at (x,y)
+void TextN(VGfloat x, VGfloat y, char *s, int n, int pointsize) {
+	textat(x, y, s, n, pointsize, 0.0f);
+}
+
+// TextWidth returns the width of a text string at the specified font and size.
+VGfloat TextWidth(char *s, int pointsize) {
+	return textwidth(s, strlen(s)) * pointsize;
+}
+
+// TextWidthN returns the width of the first n bytes of s at the specified size
+VGfloat TextWidthN(char *s, int n, int pointsize) {
+	return textwidth(s, n) * pointsize;
+}
+
+// TextBBox returns the ink bounding box of text drawn at (0,0) as x, y, width, height
+void TextBBox(char *s, int pointsize, VGfloat box[4]) {
+	layout(&scratch, s, strlen(s));
+	for (int i = 0; i < 4; i++) {
+		box[i] = scratch.bbox[i] * pointsize;
+	}
+}
+
+// TextMid draws text, centered on (x,y)
+void TextMid(VGfloat x, VGfloat y, char *s, int pointsize) {
+	textat(x, y, s, strlen(s), pointsize, 0.5f);
+}
+
+// TextMidN draws the first n bytes of s, centered on (x,y)
+void TextMidN(VGfloat x, VGfloat y, char *s, int n, int pointsize) {
+	textat(x, y, s, n, pointsize, 0.5f);
+}
+
+// TextRaster draws text with its start at (x,y) from the glyph atlas, whatever the
+// size and transform
+void TextRaster(VGfloat x, VGfloat y, char *s, int pointsize) {
+	if (reachculled(x, y, strlen(s), pointsize, 0.0f)) {
+		return;
+	}
+	layout(&scratch, s, strlen(s));
+	if (!inkculled(scratch.bbox, x, y, pointsize)) {
+		drawatlas(&scratch, x, y, pointsize);
+	}
+}
+
+// TextEnd draws text, with its end aligned to (x,y)
+void TextEnd(VGfloat x, VGfloat y, char *s, int pointsize) {
+	textat(x, y, s, strlen(s), pointsize, 1.0f);
+}
+
+// TextEndN draws the first n bytes of s, with its end aligned to (x,y)
+void TextEndN(VGfloat x, VGfloat y, char *s, int n, int pointsize) {
+	textat(x, y, s, n, pointsize, 1.0f);
+}
+
+//
+// Text fitting and wrapping
+//
+
+// lineheight returns the selected font's line spacing at unit size
+static VGfloat lineheight() {
+	font *f = &fonts[textfont];
+	if (f->state == FONTPENDING) {
+		fontwait(textfont);
+	}
+	if (f->state == FONTFAILED) {
+		return 0;
+	}
+	if (f->bundle != NULL) {
+		return f->bundle->height / 65536.0f;
+	}
+	return f->face->size->metrics.height / 4096.0f;
+}
+
+// linedescent returns the selected font's descender, negative below the baseline, at unit size
+static VGfloat linedescent() {
+	font *f = &fonts[textfont];
+	if (f->state != FONTREADY) {
+		return 0;
+	}
+	if (f->bundle != NULL) {
+		return f->bundle->descender / 65536.0f;
+	}
+	return f->face->size->metrics.descender / 4096.0f;
+}
+
+// TextLineHeight returns the line spacing of the selected font at the specified size
+VGfloat TextLineHeight(int pointsize) {
+	return lineheight() * pointsize;
+}
+
+// TextFit returns the largest size at which text fits within width and, if height is
+// positive, whose line spacing fits within height. Text scales linearly with size,
+// so a single measurement at unit size is enough.
+int TextFit(char *s, VGfloat width, VGfloat height) {
+	VGfloat tw = textwidth(s, strlen(s)), lh = lineheight(), size = -1.0f;
+
+	if (tw > 0) {
+		size = width / tw;
+	}
+	if (height > 0 && lh > 0 && (size < 0 || height / lh < size)) {
+		size = height / lh;
+	}
+	return size > 0 ? (int)size : 0;
+}
+
+// widebreak reports whether a line may break on either side of c without a space:
+// CJK ideographs and punctuation, kana, hangul and fullwidth forms
+static int widebreak(unsigned int c) {
+	return (c >= 0x2E80 && c <= 0x9FFF) ||
+	    (c >= 0xA960 && c <= 0xA97F) ||
+	    (c >= 0xAC00 && c <= 0xD7AF) ||
+	    (c >= 0xF900 && c <= 0xFAFF) ||
+	    (c >= 0xFE30 && c <= 0xFE4F) || (c >= 0xFF00 && c <= 0xFFEF) || (c >= 0x20000 && c <= 0x3FFFF);
+}
+
+// characters a line must not start with: closing punctuation, small kana and marks
+static const unsigned int nobreakbefore[] = {
+	0x0021, 0x0029, 0x002C, 0x002E, 0x003A, 0x003B, 0x003F, 0x005D, 0x007D,
+	0x2019, 0x201D, 0x2025, 0x2026, 0x3001, 0x3002, 0x3005, 0x3009, 0x300B,
+	0x300D, 0x300F, 0x3011, 0x3015, 0x3017, 0x3019, 0x301F, 0x3041, 0x3043,
+	0x3045, 0x3047, 0x3049, 0x3063, 0x3083, 0x3085, 0x3087, 0x308E, 0x309D,
+	0x309E, 0x30A1, 0x30A3, 0x30A5, 0x30A7, 0x30A9, 0x30C3, 0x30E3, 0x30E5,
+	0x30E7, 0x30EE, 0x30F5, 0x30F6, 0x30FB, 0x30FC, 0x30FD, 0x30FE, 0xFF01,
+	0xFF09, 0xFF0C, 0xFF0E, 0xFF1A, 0xFF1B, 0xFF1F, 0xFF3D, 0xFF5D
+};
+
+// characters a line must not end with: opening brackets and quotes
+static const unsigned int nobreakafter[] = {
+	0x0028, 0x005B, 0x007B, 0x2018, 0x201C, 0x3008, 0x300A, 0x300C, 0x300E,
+	0x3010, 0x3014, 0x3016, 0x3018, 0x301D, 0xFF08, 0xFF3B, 0xFF5B
+};
+
+// inset reports whether c is in a sorted set of n codepoints
+static int inset(const unsigned int *set, int n, unsigned int c) {
+	int lo = 0, hi = n - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (set[mid] == c) {
+			return 1;
+		}
+		if (set[mid] < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return 0;
+}
+
+// canbreak reports whether a line may break between prev and c without a space
+static int canbreak(unsigned int prev, unsigned int c) {
+	return (widebreak(prev) || widebreak(c)) &&
+	    !inset(nobreakbefore, sizeof(nobreakbefore) / sizeof(nobreakbefore[0]), c) &&
+	    !inset(nobreakafter, sizeof(nobreakafter) / sizeof(nobreakafter[0]), prev);
+}
+
+// blockline is one wrapped line of a text block
+typedef struct {
+	unsigned int hash;
+	struct textlayout *layout;
+} blockline;
+
+// blockpara is one paragraph of a text block and the run of lines it wrapped to
+typedef struct {
+	unsigned int hash;
+	int start, len;						   // bytes of the block's text
+	int line, nlines;					   // lines, or nlines < 0 once reused
+} blockpara;
+
+struct textblock {
+	char *text;
+	int len;
+	VGfloat width;						   // wrap width and size
+	int pointsize;
+	int font;						   // font, font generation and kerning
+	unsigned int gen;					   // the block was wrapped with
+	int kerned;
+	VGfloat leading;					   // line spacing, at unit size
+	blockline *lines;
+	int n, cap;
+	blockpara *paras;
+	int np, pcap;
+	int scan;						   // next old line to look at for reuse
+};
+
+#define LINESCAN 64						   // old lines searched for a reusable layout
+
+// addline adds a line of n bytes at s, taking the layout of an identical line
+// among the next few old ones if there is one
+static void addline(struct textblock *b, struct textblock *old, const char *s, int n) {
+	unsigned int hash = strhash(s, n);
+	struct textlayout *l = NULL;
+
+	for (int i = old->scan; i < old->n && i < old->scan + LINESCAN; i++) {
+		blockline *o = &old->lines[i];
+		if (o->layout != NULL && o->hash == hash && o->layout->len == n && memcmp(o->layout->text, s, n) == 0) {
+			l = o->layout;
+			o->layout = NULL;
+			old->scan = i + 1;
+			break;
+		}
+	}
+	if (l == NULL) {
+		l = newlayout(s, n);
+	}
+	if (b->n == b->cap) {
+		b->cap = b->cap ? b->cap * 2 : 16;
+		b->lines = realloc(b->lines, b->cap * sizeof(blockline));
+	}
+	b->lines[b->n].hash = hash;
+	b->lines[b->n].layout = l;
+	b->n++;
+}
+
+// wrap breaks bytes start to end of the block's text into lines no wider than the
+// block. Lines break after a run of spaces, which is dropped, or between CJK
+// characters; a word too long for a line is broken where it overflows.
+static void wrap(struct textblock *b, struct textblock *old, int start, int end) {
+	const unsigned char *s = (const unsigned char *)b->text;
+	VGfloat maxw = b->width / b->pointsize, pen = 0.0f, bkpen = 0.0f;
+	int line = start, bkend = -1, bknext = 0, k;
+	unsigned int c, prevc = 0;
+	metric *prev = NULL;
+
+	for (int i = start; i < end; i += k) {
+		k = utf8next(s + i, end - i, &c);
+		metric *m = getmetric(c);
+		if (i > line && c != ' ' && prevc != ' ' && canbreak(prevc, c)) {
+			bkend = bknext = i;
+			bkpen = pen;
+		}
+		VGfloat adv = kern(prev, m) + m->advance;
+		while (c != ' ' && i > line && pen + adv > maxw) {
+			if (bkend > line) {
+				addline(b, old, b->text + line, bkend - line);
+				line = bknext;
+				pen -= bkpen;
+			} else {
+				addline(b, old, b->text + line, i - line);
+				line = i;
+				pen = 0.0f;
+			}
+			if (line == i) {
+				adv = m->advance;
+			}
+			bkend = -1;
+		}
+		pen += adv;
+		prev = m;
+		if (c == ' ' && i > line) {
+			if (prevc != ' ') {
+				bkend = i;
+			}
+			bknext = i + k;
+			bkpen = pen;
+		}
+		prevc = c;
+	}
+	addline(b, old, b->text + line, end - line);
+}
+
+// findpara returns an unused old paragraph with the same text as n bytes at s
+static blockpara *findpara(struct textblock *old, unsigned int hash, const char *s, int n) {
+	for (int i = 0; i < old->np; i++) {
+		blockpara *p = &old->paras[i];
+		if (p->nlines >= 0 && p->hash == hash && p->len == n && memcmp(old->text + p->start, s, n) == 0) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// rewrap wraps new text into a block. With reuse set, paragraphs whose text is
+// unchanged keep their lines as they are, and changed ones rewrapped into lines
+// seen before keep those lines' layouts, so only changed lines are measured again.
+static void rewrap(struct textblock *b, const char *s, int reuse) {
+	struct textblock old = *b;
+	int start = 0, selected = SetFont(b->font);
+
+	b->len = strlen(s);
+	b->text = malloc(b->len + 1);
+	memcpy(b->text, s, b->len + 1);
+	b->lines = NULL;
+	b->n = b->cap = 0;
+	b->paras = NULL;
+	b->np = b->pcap = 0;
+	b->gen = fontgen;
+	b->kerned = kerning;
+	b->leading = lineheight();
+	old.scan = 0;
+
+	for (;;) {
+		int end = start;
+		while (end < b->len && b->text[end] != '\n') {
+			end++;
+		}
+		unsigned int hash = strhash(b->text + start, end - start);
+		blockpara *o = reuse ? findpara(&old, hash, b->text + start, end - start) : NULL;
+		if (b->np == b->pcap) {
+			b->pcap = b->pcap ? b->pcap * 2 : 8;
+			b->paras = realloc(b->paras, b->pcap * sizeof(blockpara));
+		}
+		blockpara *p = &b->paras[b->np++];
+		p->hash = hash;
+		p->start = start;
+		p->len = end - start;
+		p->line = b->n;
+		if (o != NULL) {
+			for (int i = 0; i < o->nlines; i++) {
+				blockline *ol = &old.lines[o->line + i];
+				if (b->n == b->cap) {
+					b->cap = b->cap ? b->cap * 2 : 16;
+					b->lines = realloc(b->lines, b->cap * sizeof(blockline));
+				}
+				b->lines[b->n++] = *ol;
+				ol->layout = NULL;
+			}
+			o->nlines = -1;
+		} else {
+			wrap(b, &old, start, end);
+		}
+		p->nlines = b->n - p->line;
+		if (end == b->len) {
+			break;
+		}
+		start = end + 1;
+	}
+	SetFont(selected);
+
+	for (int i = 0; i < old.n; i++) {
+		DeleteTextLayout(old.lines[i].layout);
+	}
+	free(old.lines);
+	free(old.paras);
+	free(old.text);
+}
+
+// NewTextBlock wraps text to lines no wider than width at the specified size, in
+// the selected font. Newlines start new paragraphs.
+TextBlock NewTextBlock(char *s, VGfloat width, int pointsize) {
+	struct textblock *b = calloc(1, sizeof(struct textblock));
+	b->width = width;
+	b->pointsize = pointsize;
+	b->font = textfont;
+	rewrap(b, s, 0);
+	return b;
+}
+
+// TextBlockUpdate replaces the text of a block, measuring only the lines that changed
+void TextBlockUpdate(TextBlock b, char *s) {
+	rewrap(b, s, b->gen == fontgen && b->kerned == kerning);
+}
+
+// TextBlockResize wraps a block again to a new width and size
+void TextBlockResize(TextBlock b, VGfloat width, int pointsize) {
+	if (width != b->width || pointsize != b->pointsize) {
+		b->width = width;
+		b->pointsize = pointsize;
+		rewrap(b, b->text, 0);
+	}
+}
+
+// DeleteTextBlock frees a text block
+void DeleteTextBlock(TextBlock b) {
+	if (b != NULL) {
+		for (int i = 0; i < b->n; i++) {
+			DeleteTextLayout(b->lines[i].layout);
+		}
+		free(b->lines);
+		free(b->paras);
+		free(b->text);
+		free(b);
+	}
+}
+
+// refreshblock wraps a block again if its font's fallbacks or the kerning changed
+static struct textblock *refreshblock(struct textblock *b) {
+	if (b->gen != fontgen || b->kerned != kerning) {
+		rewrap(b, b->text, 0);
+	}
+	return b;
+}
+
+// TextBlockLines returns the number of lines a block wrapped to
+int TextBlockLines(TextBlock b) {
+	return refreshblock(b)->n;
+}
+
+// drawblock draws the lines of a block downward from the baseline y, each starting
+// at x - (anchor * line width); leading <= 0 uses the font's line spacing
+static void drawblock(struct textblock *b, VGfloat x, VGfloat y, VGfloat leading, VGfloat anchor) {
+	refreshblock(b);
+	if (leading <= 0) {
+		leading = b->leading * b->pointsize;
+	}
+	for (int i = 0; i < b->n; i++, y -= leading) {
+		struct textlayout *l = relayout(b->lines[i].layout);
+		if (l->n > 0) {
+			drawlayout(l, x - (anchor * l->width * b->pointsize), y, b->pointsize);
+		}
+	}
+}
+
+// TextBlockDraw draws a block with its first line starting at (x,y)
+void TextBlockDraw(TextBlock b, VGfloat x, VGfloat y, VGfloat leading) {
+	drawblock(b, x, y, leading, 0.0f);
+}
+
+// TextBlockMid draws a block with each line centered on x, the first on (x,y)
+void TextBlockMid(TextBlock b, VGfloat x, VGfloat y, VGfloat leading) {
+	drawblock(b, x, y, leading, 0.5f);
+}
+
+// TextBlockEnd draws a block with each line ending at x, the first at (x,y)
+void TextBlockEnd(TextBlock b, VGfloat x, VGfloat y, VGfloat leading) {
+	drawblock(b, x, y, leading, 1.0f);
+}
+
+//
+// Text views
+//
+
+// viewline is a laid out line of a text view, cached by line number
+typedef struct {
+	int line;						   // -1 when unused
+	struct textlayout layout;
+} viewline;
+
+struct textview {
+	const char *text;					   // the document: buf, or the file mapping
+	size_t len;
+	char *buf;						   // text owned by the view
+	size_t cap;
+	void *map;						   // mapped file, and its descriptor or -1
+	size_t maplen;
+	int fd;
+	size_t *lines;						   // byte offset of the start of each line
+	int nlines, linecap;
+	VGfloat width, height;
+	int pointsize;
+	int font;
+	VGfloat scroll;						   // pixels scrolled from the top of the document
+	viewline *cache;					   // layouts of the lines around the visible ones
+	int ncache;
+};
+
+#define VIEWMARGIN 8						   // lines laid out beyond each edge of the view
+
+// viewindex adds the lines starting in the text from byte offset from on
+static void viewindex(struct textview *v, size_t from) {
+	const char *p = v->text + from, *end = v->text + v->len;
+
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+		p++;
+		if (v->nlines == v->linecap) {
+			v->linecap *= 2;
+			v->lines = realloc(v->lines, v->linecap * sizeof(size_t));
+		}
+		v->lines[v->nlines++] = p - v->text;
+	}
+}
+
+// viewforget drops the cached layout of a line, as when it grew
+static void viewforget(struct textview *v, int line) {
+	if (v->ncache > 0 && v->cache[line % v->ncache].line == line) {
+		v->cache[line % v->ncache].line = -1;
+	}
+}
+
+// newview makes an empty view of the given size in pixels
+static struct textview *newview(VGfloat width, VGfloat height, int pointsize) {
+	struct textview *v = calloc(1, sizeof(struct textview));
+
+	v->width = width;
+	v->height = height;
+	v->pointsize = pointsize;
+	v->font = textfont;
+	v->fd = -1;
+	v->text = "";
+	v->linecap = 1024;
+	v->lines = malloc(v->linecap * sizeof(size_t));
+	v->lines[0] = 0;
+	v->nlines = 1;
+	return v;
+}
+
+// NewTextView makes a scrolling view, width by height pixels, of text appended to it
+TextView NewTextView(VGfloat width, VGfloat height, int pointsize) {
+	return newview(width, height, pointsize);
+}
+
+// viewmap maps a view's file again if it grew, returning the previous length
+static size_t viewmap(struct textview *v) {
+	struct stat st;
+	size_t old = v->len;
+
+	if (fstat(v->fd, &st) < 0 || (size_t)st.st_size <= v->maplen) {
+		return old;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, v->fd, 0);
+	if (p == MAP_FAILED) {
+		return old;
+	}
+	if (v->map != NULL) {
+		munmap(v->map, v->maplen);
+	}
+	v->map = p;
+	v->maplen = st.st_size;
+	v->text = p;
+	v->len = st.st_size;
+	return old;
+}
+
+// OpenTextView makes a scrolling view of a file, which is mapped rather than read
+TextView OpenTextView(char *filename, VGfloat width, VGfloat height, int pointsize) {
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+	struct textview *v = newview(width, height, pointsize);
+	v->fd = fd;
+	viewmap(v);
+	viewindex(v, 0);
+	return v;
+}
+
+// TextViewReload indexes whatever has been added to a view's file since it was
+// last mapped, as when following a log, and returns the number of lines added
+int TextViewReload(TextView v) {
+	int before = v->nlines;
+
+	if (v->fd >= 0) {
+		size_t old = viewmap(v);
+		if (v->len > old) {
+			viewforget(v, v->nlines - 1);
+			viewindex(v, old);
+		}
+	}
+	return v->nlines - before;
+}
+
+// TextViewAppend adds n bytes of text to the end of a view, indexing only what
+// was added. A view of a file is copied into memory on its first append.
+void TextViewAppend(TextView v, char *s, int n) {
+	size_t old = v->len;
+
+	if (v->buf == NULL || v->len + n > v->cap) {
+		size_t cap = v->cap ? v->cap : 4096;
+		while (cap < v->len + n) {
+			cap *= 2;
+		}
+		char *buf = realloc(v->buf, cap);
+		if (v->buf == NULL) {
+			memcpy(buf, v->text, v->len);
+		}
+		v->buf = buf;
+		v->cap = cap;
+		v->text = buf;
+	}
+	if (v->fd >= 0) {
+		munmap(v->map, v->maplen);
+		close(v->fd);
+		v->map = NULL;
+		v->maplen = 0;
+		v->fd = -1;
+	}
+	memcpy(v->buf + v->len, s, n);
+	v->len += n;
+	viewforget(v, v->nlines - 1);
+	viewindex(v, old);
+}
+
+// TextViewLines returns the number of lines in a view
+int TextViewLines(TextView v) {
+	return v->nlines;
+}
+
+// TextViewScroll scrolls a view to offset pixels below the top of its text
+void TextViewScroll(TextView v, VGfloat offset) {
+	int selected = SetFont(v->font);
+	VGfloat leading = lineheight() * v->pointsize;
+	SetFont(selected);
+
+	if (leading <= 0) {					   // the font failed to load, or the size is 0
+		return;
+	}
+	VGfloat max = v->nlines * leading - v->height;
+
+	if (offset > max) {
+		offset = max;
+	}
+	v->scroll = offset > 0 ? offset : 0;
+}
+
+// TextViewTail scrolls a view to the end of its text
+void TextViewTail(TextView v) {
+	TextViewScroll(v, FLT_MAX);
+}
+
+// viewflush frees the cached line layouts of a view
+static void viewflush(struct textview *v) {
+	for (int i = 0; i < v->ncache; i++) {
+		if (v->cache[i].layout.merged != VG_INVALID_HANDLE) {
+			vgDestroyPath(v->cache[i].layout.merged);
+		}
+		free(v->cache[i].layout.text);
+		free(v->cache[i].layout.glyphs);
+	}
+	free(v->cache);
+	v->cache = NULL;
+	v->ncache = 0;
+}
+
+// DeleteTextView frees a text view
+void DeleteTextView(TextView v) {
+	if (v != NULL) {
+		viewflush(v);
+		if (v->fd >= 0) {
+			if (v->map != NULL) {
+				munmap(v->map, v->maplen);
+			}
+			close(v->fd);
+		}
+		free(v->buf);
+		free(v->lines);
+		free(v);
+	}
+}
+
+// viewlayout returns the layout of a line, laying out again only a line that is not
+// cached or was laid out before a font change. Only the part of the line that can
+// show within the view's width is laid out.
+static struct textlayout *viewlayout(struct textview *v, int line) {
+	viewline *vl = &v->cache[line % v->ncache];
+	struct textlayout *l = &vl->layout;
+
+	if (vl->line == line && l->gen == fontgen && l->kerned == kerning) {
+		return l;
+	}
+	const unsigned char *s = (const unsigned char *)v->text + v->lines[line];
+	int n = (line + 1 < v->nlines ? v->lines[line + 1] - 1 : v->len) - v->lines[line];
+	if (n > 0 && s[n - 1] == '\r') {
+		n--;
+	}
+	VGfloat maxw = v->width / v->pointsize, pen = 0.0f;
+	metric *prev = NULL;
+	unsigned int c;
+	for (int i = 0, k; i < n; i += k) {
+		if (pen > maxw) {
+			n = i;
+			break;
+		}
+		k = utf8next(s + i, n - i, &c);
+		metric *m = getmetric(c);
+		pen += kern(prev, m) + m->advance;
+		prev = m;
+	}
+	l->text = realloc(l->text, n + 1);
+	memcpy(l->text, s, n);
+	l->text[n] = '\0';
+	l->len = n;
+	layout(l, l->text, n);
+	if (l->merged != VG_INVALID_HANDLE) {
+		vgDestroyPath(l->merged);
+		l->merged = VG_INVALID_HANDLE;
+	}
+	vl->line = line;
+	return l;
+}
+
+// TextViewDraw draws the lines of a view that show in the rectangle below and to
+// the right of (x,y), laying out a few lines beyond it so that scrolling finds
+// them ready. Lines are not clipped; use ClipRect to cut those at the edges.
+void TextViewDraw(TextView v, VGfloat x, VGfloat y) {
+	int selected = SetFont(v->font);
+	VGfloat leading = lineheight() * v->pointsize, descent = linedescent() * v->pointsize;
+
+	if (leading <= 0) {					   // the font failed to load, or the size is 0
+		SetFont(selected);
+		return;
+	}
+	int rows = (int)ceilf(v->height / leading) + 1, first = (int)(v->scroll / leading);
+
+	if (v->ncache != rows + 2 * VIEWMARGIN) {
+		viewflush(v);
+		v->ncache = rows + 2 * VIEWMARGIN;
+		v->cache = calloc(v->ncache, sizeof(viewline));
+		for (int i = 0; i < v->ncache; i++) {
+			v->cache[i].line = -1;
+		}
+	}
+	for (int i = first - VIEWMARGIN; i < first + rows + VIEWMARGIN; i++) {
+		if (i < 0 || i >= v->nlines) {
+			continue;
+		}
+		struct textlayout *l = viewlayout(v, i);
+		VGfloat top = y - (i * leading - v->scroll), bottom = top - leading;
+		if (l->n > 0 && bottom < y && top > y - v->height) {
+			drawlayout(l, x, bottom - descent, v->pointsize);
+		}
+	}
+	SetFont(selected);
+}
+
+//
+// Tickers
+//
+
+struct ticker {
+	struct textlayout layout;
+	int pointsize;
+	VGImage *tiles;						   // the rendered text, in strips at most tilew pixels wide
+	int ntiles, tilew;
+	int left, bottom;					   // strip corner relative to the text origin, in pixels
+	int width, height;					   // strip size, in pixels
+	int dirty;						   // the text changed since it was rendered
+};
+
+// tickerfree destroys the rendered strips of a ticker
+static void tickerfree(struct ticker *t) {
+	for (int i = 0; i < t->ntiles; i++) {
+		if (t->tiles[i] != VG_INVALID_HANDLE) {
+			vgDestroyImage(t->tiles[i]);
+		}
+	}
+	free(t->tiles);
+	t->tiles = NULL;
+	t->ntiles = 0;
+}
+
+// tickertile draws the glyphs of a ticker that reach into the strip from x0 to x0 + w;
+// glyphs are in advance order, so the first one is found by bisection
+static void tickertile(struct ticker *t, int x0, int w) {
+	struct textlayout *l = &t->layout;
+	VGfloat size = t->pointsize, from = (x0 + t->left) / size - 2.0f, to = (x0 + t->left + w) / size + 1.0f;
+	int lo = 0, hi = l->n;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (l->glyphs[mid].x < from) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (int i = lo; i < l->n && l->glyphs[i].x <= to; i++) {
+		VGfloat mat[9] = {
+			size, 0.0f, 0.0f,
+			0.0f, size, 0.0f,
+			(size * l->glyphs[i].x) - t->left - x0, (VGfloat) - t->bottom, 1.0f
+		};
+		loadmatrix(VG_MATRIX_PATH_USER_TO_SURFACE, mat);
+		vgDrawPath(fontglyph(l->glyphs[i].font, l->glyphs[i].index)->path, VG_FILL_PATH);
+	}
+}
+
+// tickerrender renders a ticker's text once into image strips, drawing it as
+// opaque white through an offscreen surface bound to each image in turn. If
+// the strips cannot be made, the ticker draws its layout directly instead.
+static void tickerrender(struct ticker *t) {
+	struct textlayout *l = relayout(&t->layout);
+	VGfloat size = t->pointsize, clear[4], none[4] = { 0 };
+	VGfloat white[8] = { 0, 0, 0, 0, 1, 1, 1, 1 };		   // color transform: scale, then bias
+	int scissoring, transform, maxw = vgGeti(VG_MAX_IMAGE_WIDTH);
+
+	tickerfree(t);
+	t->dirty = 0;
+	t->left = (int)floorf(fminf(0, l->bbox[0]) * size) - 1;
+	t->bottom = (int)floorf(l->bbox[1] * size) - 1;
+	t->width = (int)ceilf(fmaxf(l->width, l->bbox[0] + l->bbox[2]) * size) + 1 - t->left;
+	t->height = (int)ceilf((l->bbox[1] + l->bbox[3]) * size) + 1 - t->bottom;
+	if (l->n == 0 || maxw <= 0 || t->height > vgGeti(VG_MAX_IMAGE_HEIGHT)) {
+		return;
+	}
+	t->tilew = maxw;
+	t->ntiles = (t->width + maxw - 1) / maxw;
+	t->tiles = calloc(t->ntiles, sizeof(VGImage));
+
+	getvector(VG_CLEAR_COLOR, 4, clear, 1);
+	scissoring = getint(VG_SCISSORING);
+	transform = getint(VG_COLOR_TRANSFORM);
+	setfloats(VG_CLEAR_COLOR, 4, none);
+	setint(VG_SCISSORING, VG_FALSE);
+	setint(VG_COLOR_TRANSFORM, VG_TRUE);
+	setfloats(VG_COLOR_TRANSFORM_VALUES, 8, white);
+	for (int i = 0; i < t->ntiles; i++) {
+		int w = t->width - (i * maxw) < maxw ? t->width - (i * maxw) : maxw;
+		VGImage img = vgCreateImage(VG_sRGBA_8888_PRE, w, t->height, VG_IMAGE_QUALITY_NONANTIALIASED);
+		if (img == VG_INVALID_HANDLE) {
+			break;
+		}
+		vgClearImage(img, 0, 0, w, t->height);
+		EGLSurface pb = eglCreatePbufferFromClientBuffer(state->display, EGL_OPENVG_IMAGE,
+								 (EGLClientBuffer) (uintptr_t) img, state->config, NULL);
+		if (pb == EGL_NO_SURFACE) {
+			vgDestroyImage(img);
+			break;
+		}
+		eglMakeCurrent(state->display, pb, pb, state->context);
+		tickertile(t, i * maxw, w);
+		eglMakeCurrent(state->display, state->surface, state->surface, state->context);
+		eglDestroySurface(state->display, pb);
+		t->tiles[i] = img;
+	}
+	setint(VG_COLOR_TRANSFORM, transform);
+	setint(VG_SCISSORING, scissoring);
+	setfloats(VG_CLEAR_COLOR, 4, clear);
+	for (int i = 0; i < t->ntiles; i++) {
+		if (t->tiles[i] == VG_INVALID_HANDLE) {
+			tickerfree(t);
+			break;
+		}
+	}
+}
+
+// NewTicker makes a ticker showing text at the specified size in the selected font.
+// The text is rendered once, on first draw, and then only moved; the strips take
+// four bytes per pixel of the text's width times its height.
+Ticker NewTicker(char *s, int pointsize) {
+	struct ticker *t = calloc(1, sizeof(struct ticker));
+	t->pointsize = pointsize;
+	TickerText(t, s);
+	return t;
+}
+
+// TickerText changes the text of a ticker, to be rendered again on the next draw
+void TickerText(Ticker t, char *s) {
+	struct textlayout *l = &t->layout;
+	int n = strlen(s);
+
+	if (l->text != NULL && l->len == n && memcmp(l->text, s, n) == 0) {
+		return;
+	}
+	free(l->text);
+	l->text = strdup(s);
+	l->len = n;
+	layout(l, l->text, n);
+	if (l->merged != VG_INVALID_HANDLE) {
+		vgDestroyPath(l->merged);
+		l->merged = VG_INVALID_HANDLE;
+	}
+	t->dirty = 1;
+}
+
+// TickerWidth returns the advance width of a ticker's text, in pixels
+VGfloat TickerWidth(Ticker t) {
+	return relayout(&t->layout)->width * t->pointsize;
+}
+
+// TickerDraw shows a ticker's text with its start at (x + pos, y), in the current fill,
+// only within the window from x to x + w. Each frame draws at most the strips that
+// overlap the window, whatever the length of the text. The window is clipped with a
+// scissor, so the transform should only translate.
+void TickerDraw(Ticker t, VGfloat x, VGfloat y, VGfloat w, VGfloat pos) {
+	const VGfloat *mm = matrixstack[matrixtop];
+	VGint clip[4], old[4];
+	int scissoring;
+
+	if (t->layout.gen != fontgen || t->layout.kerned != kerning) {
+		t->dirty = 1;
+		relayout(&t->layout);
+	}
+	if (culled(x, y + (t->layout.bbox[1] * t->pointsize), w, t->layout.bbox[3] * t->pointsize, 1.0f)) {
+		return;
+	}
+	if (t->dirty) {
+		tickerrender(t);
+	}
+	clip[0] = (VGint) floorf(mm[6] + x);
+	clip[1] = (VGint) floorf(mm[7] + y) + t->bottom;
+	clip[2] = (VGint) ceilf(w);
+	clip[3] = t->height;
+	scissoring = getint(VG_SCISSORING);
+	if (scissoring) {
+		getvector(VG_SCISSOR_RECTS, 4, old, 0);
+		VGint x0 = clip[0] > old[0] ? clip[0] : old[0], y0 = clip[1] > old[1] ? clip[1] : old[1];
+		VGint x1 = clip[0] + clip[2] < old[0] + old[2] ? clip[0] + clip[2] : old[0] + old[2];
+		VGint y1 = clip[1] + clip[3] < old[1] + old[3] ? clip[1] + clip[3] : old[1] + old[3];
+		clip[0] = x0, clip[1] = y0;
+		clip[2] = x1 > x0 ? x1 - x0 : 0;
+		clip[3] = y1 > y0 ? y1 - y0 : 0;
+	}
+	setint(VG_SCISSORING, VG_TRUE);
+	setints(VG_SCISSOR_RECTS, 4, clip);
+
+	if (t->ntiles == 0) {
+		drawlayout(&t->layout, x + pos, y, t->pointsize);
+	} else {
+		VGfloat ox = floorf(x + pos + 0.5f) + t->left, oy = floorf(y + 0.5f) + t->bottom;
+		int first = (int)floorf((x - ox) / t->tilew), last = (int)floorf((x + w - ox) / t->tilew);
+
+		setint(VG_IMAGE_MODE, VG_DRAW_IMAGE_STENCIL);
+		for (int i = first < 0 ? 0 : first; i <= last && i < t->ntiles; i++) {
+			drawimageat(t->tiles[i], ox + (i * t->tilew), oy);
+		}
+		setint(VG_IMAGE_MODE, VG_DRAW_IMAGE_NORMAL);
+	}
+	if (scissoring) {
+		setints(VG_SCISSOR_RECTS, 4, old);
+	} else {
+		setint(VG_SCISSORING, VG_FALSE);
+	}
+}
+
+// DeleteTicker frees a ticker and its strips
+void DeleteTicker(Ticker t) {
+	if (t != NULL) {
+		tickerfree(t);
+		if (t->layout.merged != VG_INVALID_HANDLE) {
+			vgDestroyPath(t->layout.merged);
+		}
+		free(t->layout.text);
+		free(t->layout.glyphs);
+		free(t);
+	}
+}
+
+//
+// Deferred drawing
+//
+
+// In deferred mode shapes are recorded instead of drawn, each with the state it
+// needs and its bounds on the surface. At End(), or before anything else draws,
+// they are replayed grouped by state. A shape is given a layer one above every
+// earlier shape it overlaps, and only shapes within a layer are reordered, so no
+// two overlapping shapes change places.
+
+#define DEFERMAX	1024					   // shapes recorded before a flush
+
+// drawstate is the state a recorded shape draws with
+typedef struct {
+	VGfloat fill[4];
+	VGint fillrule;
+	VGfloat stroke[4];
+	VGfloat width;
+	VGint scissoring;
+	VGint scissor[4];
+} drawstate;
+
+// deferred is a recorded shape
+typedef struct {
+	drawstate st;
+	VGPath path;
+	VGbitfield mode;
+	int owned;						   // the path is destroyed once drawn
+	VGfloat matrix[9];
+	VGfloat bbox[4];					   // surface bounds: minx, miny, maxx, maxy
+	int layer;
+	int order;
+} deferred;
+
+static int deferring;
+static deferred *deferlist;
+static int ndeferred;
+static unsigned int defergen = 1;			   // counts flushes
+
+// DeferDraw turns deferred drawing on or off, drawing anything recorded when turned off
+void DeferDraw(int on) {
+	if (!on) {
+		deferflush();
+	}
+	deferring = on;
+}
+
+// deferbounds finds the surface bounds of a recorded shape, padded for strokes and antialiasing
+static void deferbounds(deferred * d) {
+	VGfloat x = 0, y = 0, w = -1, h = -1, pad = (d->mode & VG_STROKE_PATH) ? d->st.width * 2.0f : 0.0f;
+
+	vgPathBounds(d->path, &x, &y, &w, &h);
+	if (w < 0 || h < 0) {
+		d->bbox[0] = d->bbox[1] = -FLT_MAX;
+		d->bbox[2] = d->bbox[3] = FLT_MAX;
+		return;
+	}
+	d->bbox[0] = d->bbox[1] = FLT_MAX;
+	d->bbox[2] = d->bbox[3] = -FLT_MAX;
+	for (int i = 0; i < 4; i++) {
+		VGfloat px = (i & 1) ? x + w + pad : x - pad, py = (i & 2) ? y + h + pad : y - pad;
+		VGfloat sx = (d->matrix[0] * px) + (d->matrix[3] * py) + d->matrix[6];
+		VGfloat sy = (d->matrix[1] * px) + (d->matrix[4] * py) + d->matrix[7];
+		d->bbox[0] = fminf(d->bbox[0], sx - 1);
+		d->bbox[1] = fminf(d->bbox[1], sy - 1);
+		d->bbox[2] = fmaxf(d->bbox[2], sx + 1);
+		d->bbox[3] = fmaxf(d->bbox[3], sy + 1);
+	}
+}
+
+// deferrecord records a shape drawn with matrix m, taking over its path if it is
+// owned. It returns 0, leaving the path to the caller, when the shape's paints
+// cannot be recorded.
+static int deferrecord(VGPath path, VGbitfield mode, const VGfloat m[9], int owned) {
+	const VGfloat *fill = slotcolor(&fillslot), *stroke = slotcolor(&strokeslot);
+
+	if (((mode & VG_FILL_PATH) && fill == NULL) || ((mode & VG_STROKE_PATH) && stroke == NULL)) {
+		return 0;
+	}
+	if (ndeferred == DEFERMAX) {
+		deferflush();
+	}
+	if (deferlist == NULL) {
+		deferlist = malloc(DEFERMAX * sizeof(deferred));
+	}
+	deferred *d = &deferlist[ndeferred];
+	memset(&d->st, 0, sizeof(d->st));
+	if (mode & VG_FILL_PATH) {
+		memcpy(d->st.fill, fill, sizeof(d->st.fill));
+		d->st.fillrule = getint(VG_FILL_RULE);
+	}
+	if (mode & VG_STROKE_PATH) {
+		memcpy(d->st.stroke, stroke, sizeof(d->st.stroke));
+		getvector(VG_STROKE_LINE_WIDTH, 1, &d->st.width, 1);
+	}
+	d->st.scissoring = getint(VG_SCISSORING);
+	if (d->st.scissoring) {
+		getvector(VG_SCISSOR_RECTS, 4, d->st.scissor, 0);
+	}
+	d->path = path;
+	d->mode = mode;
+	d->owned = owned;
+	memcpy(d->matrix, m, sizeof(d->matrix));
+	deferbounds(d);
+	d->layer = 0;
+	d->order = ndeferred;
+	for (int i = 0; i < ndeferred; i++) {
+		deferred *e = &deferlist[i];
+		if (e->layer >= d->layer && e->bbox[0] < d->bbox[2] && d->bbox[0] < e->bbox[2]
+		    && e->bbox[1] < d->bbox[3] && d->bbox[1] < e->bbox[3]) {
+			d->layer = e->layer + 1;
+		}
+	}
+	ndeferred++;
+	statecount.deferred++;
+	return 1;
+}
+
+// defercmp orders recorded shapes by layer, then state, then the order they were drawn
+static int defercmp(const void *a, const void *b) {
+	const deferred *x = a, *y = b;
+	if (x->layer != y->layer) {
+		return x->layer - y->layer;
+	}
+	int c = memcmp(&x->st, &y->st, sizeof(x->st));
+	return c != 0 ? c : x->order - y->order;
+}
+
+// deferchanges counts the state changes needed to replay the recorded shapes in their current order
+static unsigned long deferchanges() {
+	unsigned long n = 0;
+	const drawstate *fill = NULL, *stroke = NULL, *clip = NULL;
+
+	for (int i = 0; i < ndeferred; i++) {
+		const drawstate *st = &deferlist[i].st;
+		if ((deferlist[i].mode & VG_FILL_PATH)
+		    && (fill == NULL || memcmp(fill->fill, st->fill, sizeof(st->fill)) != 0 || fill->fillrule != st->fillrule)) {
+			fill = st, n++;
+		}
+		if ((deferlist[i].mode & VG_STROKE_PATH)
+		    && (stroke == NULL || memcmp(stroke->stroke, st->stroke, sizeof(st->stroke)) != 0 || stroke->width != st->width)) {
+			stroke = st, n++;
+		}
+		if (clip == NULL || clip->scissoring != st->scissoring
+		    || (st->scissoring && memcmp(clip->scissor, st->scissor, sizeof(st->scissor)) != 0)) {
+			clip = st, n++;
+		}
+	}
+	return n;
+}
+
+// deferrelease draws the recorded shapes if any of them uses a path about to change
+static void deferrelease(VGPath path) {
+	for (int i = 0; i < ndeferred; i++) {
+		if (deferlist[i].path == path) {
+			deferflush();
+			return;
+		}
+	}
+}
+
+// deferflush draws the recorded shapes, grouped by state, then puts back the
+// state current before the flush
+static void deferflush() {
+	if (ndeferred == 0) {
+		return;
+	}
+	savedpaint fill, stroke;
+	VGfloat width;
+	VGint scissoring = getint(VG_SCISSORING), scissor[4], fillrule = getint(VG_FILL_RULE);
+
+	paintsave(&fillslot, &fill);
+	paintsave(&strokeslot, &stroke);
+	getvector(VG_STROKE_LINE_WIDTH, 1, &width, 1);
+	if (scissoring) {
+		getvector(VG_SCISSOR_RECTS, 4, scissor, 0);
+	}
+	statecount.inorder += deferchanges();
+	qsort(deferlist, ndeferred, sizeof(deferred), defercmp);
+	statecount.reordered += deferchanges();
+
+	for (int i = 0; i < ndeferred; i++) {
+		deferred *d = &deferlist[i];
+		if (d->mode & VG_FILL_PATH) {
+			setfill(d->st.fill);
+			setint(VG_FILL_RULE, d->st.fillrule);
+		}
+		if (d->mode & VG_STROKE_PATH) {
+			setstroke(d->st.stroke);
+			StrokeWidth(d->st.width);
+		}
+		setint(VG_SCISSORING, d->st.scissoring);
+		if (d->st.scissoring) {
+			setints(VG_SCISSOR_RECTS, 4, d->st.scissor);
+		}
+		paintsync();
+		loadmatrix(VG_MATRIX_PATH_USER_TO_SURFACE, d->matrix);
+		vgDrawPath(d->path, d->mode);
+		if (d->owned) {
+			vgDestroyPath(d->path);
+		}
+	}
+	ndeferred = 0;
+	defergen++;
+
+	paintrestore(&fillslot, &fill, VG_FILL_PATH);
+	paintrestore(&strokeslot, &stroke, VG_STROKE_PATH);
+	setint(VG_FILL_RULE, fillrule);
+	setfloat(VG_STROKE_LINE_WIDTH, width);
+	setint(VG_SCISSORING, scissoring);
+	if (scissoring) {
+		setints(VG_SCISSOR_RECTS, 4, scissor);
+	}
+}
+
+//
+// Shape paths
+//
+
+// Rectangles and ellipses without a stroke are drawn from unit prototypes scaled
+// into place. Stroked ones, whose stroke would scale with them, and rounded
+// rectangles, arcs and lines are built at the origin, kept in a small cache keyed
+// by their dimensions, and moved into place.
+
+#define SHAPECACHE	64
+
+enum { SHAPERECT, SHAPEROUNDRECT, SHAPEELLIPSE, SHAPEARC, SHAPELINE };
+
+// shapeentry is a shape path built at the origin
+typedef struct {
+	int kind;
+	VGfloat p[4];						   // dimensions
+	VGPath path;
+	unsigned long used;
+	unsigned int pin;					   // defergen when last deferred, or 0
+} shapeentry;
+
+static VGPath unitrect, unitellipse;
+static shapeentry shapecache[SHAPECACHE];
+static unsigned long shapeclock;
+
+// newpath creates path data
+VGPath newpath() {
+	return vgCreatePath(VG_PATH_FORMAT_STANDARD, VG_PATH_DATATYPE_F, 1.0f, 0.0f, 0, 0, VG_PATH_CAPABILITY_ALL);
+}
+
+// buildshape makes the path of a shape at the origin
+static VGPath buildshape(int kind, const VGfloat p[4]) {
+	VGPath path = newpath();
+	switch (kind) {
+	case SHAPERECT:
+		vguRect(path, 0, 0, p[0], p[1]);
+		break;
+	case SHAPEROUNDRECT:
+		vguRoundRect(path, 0, 0, p[0], p[1], p[2], p[3]);
+		break;
+	case SHAPEELLIPSE:
+		vguEllipse(path, 0, 0, p[0], p[1]);
+		break;
+	case SHAPEARC:
+		vguArc(path, 0, 0, p[0], p[1], p[2], p[3], VGU_ARC_OPEN);
+		break;
+	case SHAPELINE:
+		vguLine(path, 0, 0, p[0], p[1]);
+		break;
+	}
+	return path;
+}
+
+// shapepath returns the cached path of a shape, building it if needed. Paths
+// waiting in the deferred list are not evicted; if every one is, the path is
+// built for this draw only and *owned is set.
+static VGPath shapepath(int kind, VGfloat a, VGfloat b, VGfloat c, VGfloat d, int *owned) {
+	VGfloat p[4] = { a, b, c, d };
+	shapeentry *victim = NULL;
+
+	*owned = 0;
+	for (int i = 0; i < SHAPECACHE; i++) {
+		shapeentry *e = &shapecache[i];
+		if (e->path != VG_INVALID_HANDLE && e->kind == kind && memcmp(e->p, p, sizeof(p)) == 0) {
+			e->used = ++shapeclock;
+			if (deferring) {
+				e->pin = defergen;
+			}
+			return e->path;
+		}
+		if (e->path != VG_INVALID_HANDLE && ndeferred > 0 && e->pin == defergen) {
+			continue;
+		}
+		if (victim == NULL || e->used < victim->used) {
+			victim = e;
+		}
+	}
+	if (victim == NULL) {
+		*owned = 1;
+		return buildshape(kind, p);
+	}
+	if (victim->path != VG_INVALID_HANDLE) {
+		vgDestroyPath(victim->path);
+	}
+	victim->kind = kind;
+	memcpy(victim->p, p, sizeof(p));
+	victim->path = buildshape(kind, p);
+	victim->used = ++shapeclock;
+	victim->pin = deferring ? defergen : 0;
+	return victim->path;
+}
+
+// shapeflush destroys the prototypes and cached shape paths
+static void shapeflush() {
+	for (int i = 0; i < SHAPECACHE; i++) {
+		if (shapecache[i].path != VG_INVALID_HANDLE) {
+			vgDestroyPath(shapecache[i].path);
+		}
+	}
+	memset(shapecache, 0, sizeof(shapecache));
+	if (unitrect != VG_INVALID_HANDLE) {
+		vgDestroyPath(unitrect);
+		vgDestroyPath(unitellipse);
+		unitrect = unitellipse = VG_INVALID_HANDLE;
+	}
+}
+
+// drawat draws a path placed by the surface matrix m, destroying it afterwards if it is owned
+static void drawat(VGPath path, const VGfloat m[9], VGbitfield mode, int owned) {
+	if (deferring && deferrecord(path, mode, m, owned)) {
+		return;
+	}
+	deferflush();
+	paintsync();
+	loadmatrix(VG_MATRIX_PATH_USER_TO_SURFACE, m);
+	vgDrawPath(path, mode);
+	if (owned) {
+		vgDestroyPath(path);
+	}
+}
+
+// placeshape draws a path scaled by (sx,sy) and moved to (x,y) within the
+// current transform, destroying it afterwards if it is owned
+static void placeshape(VGPath path, VGfloat sx, VGfloat sy, VGfloat x, VGfloat y, VGbitfield mode, int owned) {
+	VGfloat m[9];
+
+	placematrix(m, sx, sy, x, y);
+	drawat(path, m, mode, owned);
+}
+
+// cachedshape draws a shape from the cache, moved to (x,y)
+static void cachedshape(int kind, VGfloat x, VGfloat y, VGfloat a, VGfloat b, VGfloat c, VGfloat d, VGbitfield mode) {
+	int owned;
+	VGPath path = shapepath(kind, a, b, c, d, &owned);
+	placeshape(path, 1.0f, 1.0f, x, y, mode, owned);
+}
+
+// unitshape draws a unit prototype scaled to w by h and moved to (x,y)
+static void unitshape(int kind, VGfloat x, VGfloat y, VGfloat w, VGfloat h) {
+	if (unitrect == VG_INVALID_HANDLE) {
+		unitrect = newpath();
+		vguRect(unitrect, 0, 0, 1, 1);
+		unitellipse = newpath();
+		vguEllipse(unitellipse, 0, 0, 1, 1);
+	}
+	placeshape(kind == SHAPERECT ? unitrect : unitellipse, w, h, x, y, VG_FILL_PATH, 0);
+}
+
+// stroking reports whether strokes are drawn: a width of 0 or less draws none
+static int stroking() {
+	VGfloat width;
+	getvector(VG_STROKE_LINE_WIDTH, 1, &width, 1);
+	return width > 0;
+}
+
+// batchbuf accumulates the segments and coordinates of a path being built:
+// a batch, a polygon or a decimated series
+static struct {
+	VGubyte *segs;
+	VGfloat *coords;
+	int nseg, ncoord;
+	int segcap, coordcap;
+	int *order;						   // shapes sorted by color
+	int ordercap;
+} batchbuf;
+
+// batchreserve makes room for nseg more segments and ncoord more coordinates
+static void batchreserve(int nseg, int ncoord) {
+	if (batchbuf.nseg + nseg > batchbuf.segcap) {
+		batchbuf.segcap = (batchbuf.nseg + nseg) * 2;
+		batchbuf.segs = realloc(batchbuf.segs, batchbuf.segcap);
+	}
+	if (batchbuf.ncoord + ncoord > batchbuf.coordcap) {
+		batchbuf.coordcap = (batchbuf.ncoord + ncoord) * 2;
+		batchbuf.coords = realloc(batchbuf.coords, batchbuf.coordcap * sizeof(VGfloat));
+	}
+}
+
+// batchadd appends segments and their coordinates to the batch
+static void batchadd(const VGubyte * segs, int nseg, const VGfloat * coords, int ncoord) {
+	batchreserve(nseg, ncoord);
+	memcpy(batchbuf.segs + batchbuf.nseg, segs, nseg);
+	memcpy(batchbuf.coords + batchbuf.ncoord, coords, ncoord * sizeof(VGfloat));
+	batchbuf.nseg += nseg;
+	batchbuf.ncoord += ncoord;
 }
 
+// batchpath makes a path of the accumulated segments, emptying the buffer
+static VGPath batchpath() {
+	VGPath path = newpath();
+	vgAppendPathData(path, batchbuf.nseg, batchbuf.segs, batchbuf.coords);
+	batchbuf.nseg = batchbuf.ncoord = 0;
+	return path;
+}
+
+// shapemode is the drawing mode of a filled shape
+static VGbitfield shapemode() {
+	return stroking() ? VG_FILL_PATH | VG_STROKE_PATH : VG_FILL_PATH;
+}
+
+// shape draws a path made for a single shape, and destroys it
+static void shape(VGPath path, VGbitfield mode) {
+	placeshape(path, 1.0f, 1.0f, 0.0f, 0.0f, mode, 1);
+}
+
+//
+// Shape functions
+//
+
 // makecurve makes path data using specified segments and coordinates
 void makecurve(VGubyte * segments, VGfloat * coords) {
 	VGPath path = newpath();
 	vgAppendPathData(path, 2, segments, coords);
-	vgDrawPath(path, VG_FILL_PATH | VG_STROKE_PATH);
-	vgDestroyPath(path);
+	shape(path, VG_FILL_PATH | VG_STROKE_PATH);
 }
 
 // CBezier makes a quadratic bezier curve
 void Cbezier(VGfloat sx, VGfloat sy, VGfloat cx, VGfloat cy, VGfloat px, VGfloat py, VGfloat ex, VGfloat ey) {
 	VGubyte segments[] = { VG_MOVE_TO_ABS, VG_CUBIC_TO };
 	VGfloat coords[] = { sx, sy, cx, cy, px, py, ex, ey };
-	makecurve(segments, coords);
+	if (!pointsculled(coords, 4, strokepad(shapemode()))) {	   // the curve lies within its control points
+		makecurve(segments, coords);
+	}
 }
 
 // QBezier makes a quadratic bezier curve
 void Qbezier(VGfloat sx, VGfloat sy, VGfloat cx, VGfloat cy, VGfloat ex, VGfloat ey) {
 	VGubyte segments[] = { VG_MOVE_TO_ABS, VG_QUAD_TO };
 	VGfloat coords[] = { sx, sy, cx, cy, ex, ey };
-	makecurve(segments, coords);
+	if (!pointsculled(coords, 3, strokepad(shapemode()))) {
+		makecurve(segments, coords);
+	}
 }
 
 // interleave interleaves arrays of x, y into a single array
@@ -634,12 +4426,19 @@ void interleave(VGfloat * x, VGfloat * y, int n, VGfloat * points) {
 
 // poly makes either a polygon or polyline
 void poly(VGfloat * x, VGfloat * y, VGint n, VGbitfield flag) {
-	VGfloat points[n * 2];
-	VGPath path = newpath();
-	interleave(x, y, n, points);
-	vguPolygon(path, points, n, VG_FALSE);
-	vgDrawPath(path, flag);
-	vgDestroyPath(path);
+	if (n <= 0) {
+		return;
+	}
+	batchreserve(n, n * 2);
+	batchbuf.segs[0] = VG_MOVE_TO_ABS;
+	memset(batchbuf.segs + 1, VG_LINE_TO_ABS, n - 1);
+	interleave(x, y, n, batchbuf.coords);
+	if (pointsculled(batchbuf.coords, n, strokepad(flag))) {
+		return;
+	}
+	batchbuf.nseg = n;
+	batchbuf.ncoord = n * 2;
+	shape(batchpath(), flag);
 }
 
 // Polygon makes a filled polygon with vertices in x, y arrays
@@ -652,36 +4451,126 @@ void Polyline(VGfloat * x, VGfloat * y, VGint n) {
 	poly(x, y, n, VG_STROKE_PATH);
 }
 
+// seriesrun is a run of consecutive samples in one pixel column
+typedef struct {
+	VGfloat col;
+	int first, lo, hi, last;
+} seriesrun;
+
+// seriesx is the x of sample i, counting from 0 when there are no x values
+#define seriesx(x, i, stride) ((x) != NULL ? (x)[(i) * (stride)] : (VGfloat) (i))
+
+// seriespoint appends a point of a series, starting a subpath if none is open
+static void seriespoint(VGfloat x, VGfloat y, int *open) {
+	VGubyte seg = *open ? VG_LINE_TO_ABS : VG_MOVE_TO_ABS;
+	VGfloat coords[] = { x, y };
+	batchadd(&seg, 1, coords, 2);
+	*open = 1;
+}
+
+// seriesflush appends the first, lowest, highest and last samples of a run, in sample order
+static void seriesflush(VGfloat * x, VGfloat * y, int stride, const seriesrun * r, int *open) {
+	int k[4] = { r->first, r->lo < r->hi ? r->lo : r->hi, r->lo < r->hi ? r->hi : r->lo, r->last };
+	for (int i = 0; i < 4; i++) {
+		if (i == 0 || k[i] != k[i - 1]) {
+			seriespoint(seriesx(x, k[i], stride), y[k[i] * stride], open);
+		}
+	}
+}
+
+// PolylineSeries draws a polyline through n samples at (x[i * stride], y[i * stride]),
+// or at x = i if x is NULL. Where consecutive samples fall in one pixel column under
+// the current transform, only the first, lowest, highest and last are drawn, which
+// covers the same pixels. A sample whose y is NaN breaks the line.
+void PolylineSeries(VGfloat * x, VGfloat * y, VGint n, VGint stride) {
+	const VGfloat *m = matrixstack[matrixtop];
+	int decimate = m[1] == 0 && m[3] == 0, open = 0, inrun = 0;
+	seriesrun r;
+
+	if (!stroking()) {
+		return;
+	}
+	if (stride < 1) {
+		stride = 1;
+	}
+	for (int i = 0; i < n; i++) {
+		VGfloat sy = y[i * stride], sx = seriesx(x, i, stride);
+		if (isnan(sy)) {
+			if (inrun) {
+				seriesflush(x, y, stride, &r, &open);
+			}
+			inrun = open = 0;
+			continue;
+		}
+		if (!decimate) {
+			seriespoint(sx, sy, &open);
+			continue;
+		}
+		VGfloat col = floorf((m[0] * sx) + m[6]);
+		if (inrun && col == r.col) {
+			r.last = i;
+			if (sy < y[r.lo * stride]) {
+				r.lo = i;
+			}
+			if (sy > y[r.hi * stride]) {
+				r.hi = i;
+			}
+			continue;
+		}
+		if (inrun) {
+			seriesflush(x, y, stride, &r, &open);
+		}
+		r.col = col;
+		r.first = r.lo = r.hi = r.last = i;
+		inrun = 1;
+	}
+	if (inrun) {
+		seriesflush(x, y, stride, &r, &open);
+	}
+	if (pointsculled(batchbuf.coords, batchbuf.ncoord / 2, strokepad(VG_STROKE_PATH))) {
+		batchbuf.nseg = batchbuf.ncoord = 0;
+	} else if (batchbuf.nseg > 0) {
+		shape(batchpath(), VG_STROKE_PATH);
+	}
+}
+
 // Rect makes a rectangle at the specified location and dimensions
 void Rect(VGfloat x, VGfloat y, VGfloat w, VGfloat h) {
-	VGPath path = newpath();
-	vguRect(path, x, y, w, h);
-	vgDrawPath(path, VG_FILL_PATH | VG_STROKE_PATH);
-	vgDestroyPath(path);
+	if (culled(x, y, w, h, strokepad(shapemode()))) {
+		return;
+	}
+	if (stroking()) {
+		cachedshape(SHAPERECT, x, y, w, h, 0, 0, VG_FILL_PATH | VG_STROKE_PATH);
+	} else if (w > 0 && h > 0) {
+		unitshape(SHAPERECT, x, y, w, h);
+	}
 }
 
 // Line makes a line from (x1,y1) to (x2,y2)
 void Line(VGfloat x1, VGfloat y1, VGfloat x2, VGfloat y2) {
-	VGPath path = newpath();
-	vguLine(path, x1, y1, x2, y2);
-	vgDrawPath(path, VG_STROKE_PATH);
-	vgDestroyPath(path);
+	if (stroking() && !culled(x1, y1, x2 - x1, y2 - y1, strokepad(VG_STROKE_PATH))) {
+		cachedshape(SHAPELINE, x1, y1, x2 - x1, y2 - y1, 0, 0, VG_STROKE_PATH);
+	}
 }
 
 // Roundrect makes an rounded rectangle at the specified location and dimensions
 void Roundrect(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat rw, VGfloat rh) {
-	VGPath path = newpath();
-	vguRoundRect(path, x, y, w, h, rw, rh);
-	vgDrawPath(path, VG_FILL_PATH | VG_STROKE_PATH);
-	vgDestroyPath(path);
+	VGbitfield mode = shapemode();
+	if (!culled(x, y, w, h, strokepad(mode))) {
+		cachedshape(SHAPEROUNDRECT, x, y, w, h, rw, rh, mode);
+	}
 }
 
 // Ellipse makes an ellipse at the specified location and dimensions
 void Ellipse(VGfloat x, VGfloat y, VGfloat w, VGfloat h) {
-	VGPath path = newpath();
-	vguEllipse(path, x, y, w, h);
-	vgDrawPath(path, VG_FILL_PATH | VG_STROKE_PATH);
-	vgDestroyPath(path);
+	if (culled(x - (w / 2), y - (h / 2), w, h, strokepad(shapemode()))) {
+		return;
+	}
+	if (stroking()) {
+		cachedshape(SHAPEELLIPSE, x, y, w, h, 0, 0, VG_FILL_PATH | VG_STROKE_PATH);
+	} else if (w > 0 && h > 0) {
+		unitshape(SHAPEELLIPSE, x, y, w, h);
+	}
 }
 
 // Circle makes a circle at the specified location and dimensions
@@ -691,34 +4580,41 @@ void Circle(VGfloat x, VGfloat y, VGfloat r) {
 
 // Arc makes an elliptical arc at the specified location and dimensions
 void Arc(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat sa, VGfloat aext) {
-	VGPath path = newpath();
-	vguArc(path, x, y, w, h, sa, aext, VGU_ARC_OPEN);
-	vgDrawPath(path, VG_FILL_PATH | VG_STROKE_PATH);
-	vgDestroyPath(path);
+	VGbitfield mode = shapemode();
+	if (!culled(x - (w / 2), y - (h / 2), w, h, strokepad(mode))) {
+		cachedshape(SHAPEARC, x, y, w, h, sa, aext, mode);
+	}
 }
 
 // Start begins the picture, clearing a rectangular region with a specified color
 void Start(int width, int height) {
 	VGfloat color[4] = { 255, 255, 255, 1 };
-	vgSetfv(VG_CLEAR_COLOR, 4, color);
+	deferflush();
+	setfloats(VG_CLEAR_COLOR, 4, color);
 	vgClear(0, 0, width, height);
 	color[0] = 0, color[1] = 0, color[2] = 0;
 	setfill(color);
 	setstroke(color);
 	StrokeWidth(0);
-	vgLoadIdentity();
+	resetmatrix();
 }
 
 // End checks for errors, and renders to the display
 void End() {
+	deferflush();
 //      assert(vgGetError() == VG_NO_ERROR);
 	eglSwapBuffers(state->display, state->surface);
 	assert(eglGetError() == EGL_SUCCESS);
+	startupmark(&startup.firstframe);
+	statetick();
+	fontpoll();
+	warmdrain(WARMBUDGET);
 }
 
 // SaveEnd dumps the raster before rendering to the display 
 void SaveEnd(char *filename) {
 	FILE *fp;
+	deferflush();
 	assert(vgGetError() == VG_NO_ERROR);
 	if (strlen(filename) == 0) {
 		dumpscreen(state->screen_width, state->screen_height, stdout);
@@ -731,6 +4627,10 @@ void SaveEnd(char *filename) {
 	}
 	eglSwapBuffers(state->display, state->surface);
 	assert(eglGetError() == EGL_SUCCESS);
+	startupmark(&startup.firstframe);
+	statetick();
+	fontpoll();
+	warmdrain(WARMBUDGET);
 }
 
 // clear the screen to a solid background color
@@ -744,3 +4644,473 @@ void BackgroundRGB(unsigned int r, unsigned int g, unsigned int b, VGfloat a) {
 	Fill(r, g, b, a);
 	Rect(0, 0, state->screen_width, state->screen_height);
 }
+
+//
+// Batches
+//
+
+// A batch of shapes is built into one path and drawn once. Shapes in a batch
+// are filled as one, so translucent ones do not darken where they overlap. The
+// colored forms take four color values per shape (see RGBA) and draw one path
+// per color, so where shapes of different colors overlap, the later color is
+// not necessarily on top.
+
+static const VGfloat *batchcolors;			   // colors being sorted
+
+// batchellipse appends an ellipse centered on (x,y), as vguEllipse makes it,
+// unless it is empty or, padded by pad, outside the view
+static void batchellipse(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat pad) {
+	static const VGubyte segs[] = { VG_MOVE_TO_ABS, VG_SCCWARC_TO_ABS, VG_SCCWARC_TO_ABS, VG_CLOSE_PATH };
+	VGfloat rh = w / 2, rv = h / 2;
+	VGfloat coords[] = { x + rh, y, rh, rv, 0, x - rh, y, rh, rv, 0, x + rh, y };
+	if (w > 0 && h > 0 && !culled(x - rh, y - rv, w, h, pad)) {
+		batchadd(segs, 4, coords, 12);
+	}
+}
+
+// batchrect appends a rectangle, as vguRect makes it, unless it is empty or outside the view
+static void batchrect(VGfloat x, VGfloat y, VGfloat w, VGfloat h, VGfloat pad) {
+	static const VGubyte segs[] = { VG_MOVE_TO_ABS, VG_HLINE_TO_ABS, VG_VLINE_TO_ABS, VG_HLINE_TO_ABS, VG_CLOSE_PATH };
+	VGfloat coords[] = { x, y, x + w, y + h, x };
+	if (w > 0 && h > 0 && !culled(x, y, w, h, pad)) {
+		batchadd(segs, 5, coords, 5);
+	}
+}
+
+// batchline appends a line, unless it is outside the view
+static void batchline(VGfloat x1, VGfloat y1, VGfloat x2, VGfloat y2, VGfloat pad) {
+	static const VGubyte segs[] = { VG_MOVE_TO_ABS, VG_LINE_TO_ABS };
+	VGfloat coords[] = { x1, y1, x2, y2 };
+	if (!culled(x1, y1, x2 - x1, y2 - y1, pad)) {
+		batchadd(segs, 2, coords, 4);
+	}
+}
+
+// batchdraw draws the accumulated batch as one path, filled by the nonzero
+// rule so that overlapping shapes do not cancel
+static void batchdraw(VGbitfield mode) {
+	if (batchbuf.nseg > 0) {
+		VGint fillrule = getint(VG_FILL_RULE);
+		setint(VG_FILL_RULE, VG_NON_ZERO);
+		shape(batchpath(), mode);
+		setint(VG_FILL_RULE, fillrule);
+	}
+}
+
+// batchcmp orders shapes by color, then index
+static int batchcmp(const void *a, const void *b) {
+	int i = *(const int *)a, j = *(const int *)b;
+	int c = memcmp(batchcolors + (4 * i), batchcolors + (4 * j), 4 * sizeof(VGfloat));
+	return c != 0 ? c : i - j;
+}
+
+// batchorder returns the indexes of n shapes sorted by color
+static int *batchorder(const VGfloat * colors, int n) {
+	if (n > batchbuf.ordercap) {
+		batchbuf.ordercap = n;
+		batchbuf.order = realloc(batchbuf.order, n * sizeof(int));
+	}
+	for (int i = 0; i < n; i++) {
+		batchbuf.order[i] = i;
+	}
+	batchcolors = colors;
+	qsort(batchbuf.order, n, sizeof(int), batchcmp);
+	return batchbuf.order;
+}
+
+// Circles draws n circles centered on (x[i],y[i]), of diameters r[i] like Circle
+void Circles(VGfloat * x, VGfloat * y, VGfloat * r, VGint n) {
+	VGbitfield mode = shapemode();
+	VGfloat pad = strokepad(mode);
+	for (int i = 0; i < n; i++) {
+		batchellipse(x[i], y[i], r[i], r[i], pad);
+	}
+	batchdraw(mode);
+}
+
+// Rects draws n rectangles
+void Rects(VGfloat * x, VGfloat * y, VGfloat * w, VGfloat * h, VGint n) {
+	VGbitfield mode = shapemode();
+	VGfloat pad = strokepad(mode);
+	for (int i = 0; i < n; i++) {
+		batchrect(x[i], y[i], w[i], h[i], pad);
+	}
+	batchdraw(mode);
+}
+
+// Lines draws n lines from (x1[i],y1[i]) to (x2[i],y2[i])
+void Lines(VGfloat * x1, VGfloat * y1, VGfloat * x2, VGfloat * y2, VGint n) {
+	if (stroking()) {
+		VGfloat pad = strokepad(VG_STROKE_PATH);
+		for (int i = 0; i < n; i++) {
+			batchline(x1[i], y1[i], x2[i], y2[i], pad);
+		}
+		batchdraw(VG_STROKE_PATH);
+	}
+}
+
+// CirclesColor draws n circles, each filled with its own color
+void CirclesColor(VGfloat * x, VGfloat * y, VGfloat * r, VGfloat * colors, VGint n) {
+	int *order = batchorder(colors, n);
+	VGbitfield mode = shapemode();
+	VGfloat pad = strokepad(mode);
+	savedpaint fill;
+
+	paintsave(&fillslot, &fill);
+	for (int i = 0; i < n; i++) {
+		int k = order[i];
+		batchellipse(x[k], y[k], r[k], r[k], pad);
+		if (i + 1 == n || memcmp(colors + (4 * k), colors + (4 * order[i + 1]), 4 * sizeof(VGfloat)) != 0) {
+			setfill(colors + (4 * k));
+			batchdraw(mode);
+		}
+	}
+	paintrestore(&fillslot, &fill, VG_FILL_PATH);
+}
+
+// RectsColor draws n rectangles, each filled with its own color
+void RectsColor(VGfloat * x, VGfloat * y, VGfloat * w, VGfloat * h, VGfloat * colors, VGint n) {
+	int *order = batchorder(colors, n);
+	VGbitfield mode = shapemode();
+	VGfloat pad = strokepad(mode);
+	savedpaint fill;
+
+	paintsave(&fillslot, &fill);
+	for (int i = 0; i < n; i++) {
+		int k = order[i];
+		batchrect(x[k], y[k], w[k], h[k], pad);
+		if (i + 1 == n || memcmp(colors + (4 * k), colors + (4 * order[i + 1]), 4 * sizeof(VGfloat)) != 0) {
+			setfill(colors + (4 * k));
+			batchdraw(mode);
+		}
+	}
+	paintrestore(&fillslot, &fill, VG_FILL_PATH);
+}
+
+// LinesColor draws n lines, each stroked with its own color
+void LinesColor(VGfloat * x1, VGfloat * y1, VGfloat * x2, VGfloat * y2, VGfloat * colors, VGint n) {
+	if (!stroking()) {
+		return;
+	}
+	int *order = batchorder(colors, n);
+	VGfloat pad = strokepad(VG_STROKE_PATH);
+	savedpaint stroke;
+
+	paintsave(&strokeslot, &stroke);
+	for (int i = 0; i < n; i++) {
+		int k = order[i];
+		batchline(x1[k], y1[k], x2[k], y2[k], pad);
+		if (i + 1 == n || memcmp(colors + (4 * k), colors + (4 * order[i + 1]), 4 * sizeof(VGfloat)) != 0) {
+			setstroke(colors + (4 * k));
+			batchdraw(VG_STROKE_PATH);
+		}
+	}
+	paintrestore(&strokeslot, &stroke, VG_STROKE_PATH);
+}
+
+//
+// Paths
+//
+
+// struct path is a path kept for drawing many times. Its coordinates can be
+// changed in place, keeping its segments, so animating it never rebuilds it.
+struct path {
+	VGPath path;
+	int nseg;
+	VGfloat bbox[4];					   // bounds x, y, width, height, for culling
+	int bounded;						   // bbox is known
+};
+
+// NewPath starts an empty path
+Path NewPath() {
+	struct path *p = calloc(1, sizeof(struct path));
+	p->path = newpath();
+	return p;
+}
+
+// pathseg appends a segment to a path
+static void pathseg(Path p, VGubyte seg, const VGfloat * coords) {
+	deferrelease(p->path);
+	vgAppendPathData(p->path, 1, &seg, coords);
+	p->nseg++;
+	p->bounded = 0;
+}
+
+// PathMoveTo starts a new subpath at (x,y)
+void PathMoveTo(Path p, VGfloat x, VGfloat y) {
+	VGfloat coords[] = { x, y };
+	pathseg(p, VG_MOVE_TO_ABS, coords);
+}
+
+// PathLineTo adds a line to (x,y)
+void PathLineTo(Path p, VGfloat x, VGfloat y) {
+	VGfloat coords[] = { x, y };
+	pathseg(p, VG_LINE_TO_ABS, coords);
+}
+
+// PathQuadTo adds a quadratic bezier curve through control point (cx,cy) to (x,y)
+void PathQuadTo(Path p, VGfloat cx, VGfloat cy, VGfloat x, VGfloat y) {
+	VGfloat coords[] = { cx, cy, x, y };
+	pathseg(p, VG_QUAD_TO_ABS, coords);
+}
+
+// PathCubicTo adds a cubic bezier curve through control points (c1x,c1y) and (c2x,c2y) to (x,y)
+void PathCubicTo(Path p, VGfloat c1x, VGfloat c1y, VGfloat c2x, VGfloat c2y, VGfloat x, VGfloat y) {
+	VGfloat coords[] = { c1x, c1y, c2x, c2y, x, y };
+	pathseg(p, VG_CUBIC_TO_ABS, coords);
+}
+
+// PathArcTo adds an elliptical arc to (x,y), with radii rx and ry and rotated rot degrees.
+// Of the four arcs that fit, large and clockwise choose one.
+void PathArcTo(Path p, VGfloat rx, VGfloat ry, VGfloat rot, VGfloat x, VGfloat y, int large, int clockwise) {
+	VGfloat coords[] = { rx, ry, rot, x, y };
+	VGubyte seg = large ? (clockwise ? VG_LCWARC_TO_ABS : VG_LCCWARC_TO_ABS) : (clockwise ? VG_SCWARC_TO_ABS : VG_SCCWARC_TO_ABS);
+	pathseg(p, seg, coords);
+}
+
+// PathClose closes the current subpath
+void PathClose(Path p) {
+	pathseg(p, VG_CLOSE_PATH, NULL);
+}
+
+// PathSegments returns the number of segments in a path
+int PathSegments(Path p) {
+	return p->nseg;
+}
+
+// PathCoords replaces, in place, the coordinates of n segments from segment
+// start; coords holds them in the order the segments were added
+void PathCoords(Path p, int start, int n, VGfloat * coords) {
+	deferrelease(p->path);
+	vgModifyPathCoords(p->path, start, n, coords);
+	p->bounded = 0;
+}
+
+// PathInterpolate makes p the blend of paths a and b at t, from a at 0 to b at 1.
+// a and b must have the same kinds of segments; if not, p is left empty and 0 is returned.
+int PathInterpolate(Path p, Path a, Path b, VGfloat t) {
+	deferrelease(p->path);
+	vgClearPath(p->path, VG_PATH_CAPABILITY_ALL);
+	p->nseg = vgInterpolatePath(p->path, a->path, b->path, t) ? a->nseg : 0;
+	p->bounded = 0;
+	return p->nseg > 0;
+}
+
+// pathbounds reports whether a path has bounds, asking VG for them only after it changes
+static int pathbounds(Path p) {
+	if (!p->bounded) {
+		p->bbox[2] = p->bbox[3] = -1;
+		if (p->nseg > 0) {
+			vgPathBounds(p->path, &p->bbox[0], &p->bbox[1], &p->bbox[2], &p->bbox[3]);
+		}
+		p->bounded = 1;
+	}
+	return p->bbox[2] >= 0 && p->bbox[3] >= 0;
+}
+
+// DrawPath draws a path, filled, stroked or both as mode (VG_FILL_PATH, VG_STROKE_PATH) says.
+// A path is not drawn when it lies outside the view.
+void DrawPath(Path p, VGbitfield mode) {
+	if (!pathbounds(p) || !culled(p->bbox[0], p->bbox[1], p->bbox[2], p->bbox[3], strokepad(mode))) {
+		placeshape(p->path, 1.0f, 1.0f, 0.0f, 0.0f, mode, 0);
+	}
+}
+
+// DrawInstances draws n copies of a path, filled, stroked or both as mode says. Each
+// copy is placed within the current transform by its own matrix, nine values in the
+// order vgLoadMatrix takes them. If colors is not NULL, each copy is painted its own
+// color (four values, see RGBA): the fill when filling, otherwise the stroke. Copies
+// are then drawn grouped by color, so where copies of different colors overlap, the
+// later one is not necessarily on top. Copies outside the view are skipped.
+void DrawInstances(Path p, VGfloat * matrices, VGfloat * colors, VGint n, VGbitfield mode) {
+	paintslot *ps = (mode & VG_FILL_PATH) ? &fillslot : &strokeslot;
+	int bounded = pathbounds(p), *order = colors != NULL ? batchorder(colors, n) : NULL;
+	VGfloat v[4], m[9], pad = strokepad(mode), *color = NULL;
+	savedpaint saved;
+
+	paintsave(ps, &saved);
+	viewbox(v, 1);
+	for (int i = 0; i < n; i++) {
+		int k = order != NULL ? order[i] : i;
+		matmult(m, matrixstack[matrixtop], matrices + (9 * k));
+		if (bounded && missed(v, m, p->bbox[0], p->bbox[1], p->bbox[2], p->bbox[3], pad)) {
+			continue;
+		}
+		if (colors != NULL && (color == NULL || memcmp(color, colors + (4 * k), 4 * sizeof(VGfloat)) != 0)) {
+			color = colors + (4 * k);
+			setcolor(ps, color);
+		}
+		drawat(p->path, m, mode, 0);
+	}
+	paintrestore(ps, &saved, (mode & VG_FILL_PATH) ? VG_FILL_PATH : VG_STROKE_PATH);
+}
+
+// DeletePath frees a path
+void DeletePath(Path p) {
+	if (p != NULL) {
+		deferrelease(p->path);
+		vgDestroyPath(p->path);
+		free(p);
+	}
+}
+
+//
+// Contours
+//
+
+// A contour is a polygon or polyline with many points, drawn at the detail the
+// current scale can show. Each point is ranked once by Douglas-Peucker
+// simplification with the largest tolerance at which it is still kept. Level k
+// keeps the points ranked above extent / 2^(CONTOURLEVELS - k), where extent is
+// the larger side of the bounding box; level 0 keeps them all. A level's path is
+// made the first time it is drawn and kept.
+
+#define CONTOURLEVELS	16
+#define CONTOURERROR	0.5f					   // largest drawn error, in pixels
+
+struct contour {
+	VGfloat *xy;						   // points, interleaved
+	VGfloat *rank;						   // largest tolerance keeping each point
+	int n;
+	VGfloat bbox[4];					   // bounds x, y, width, height
+	VGfloat extent;
+	VGPath level[CONTOURLEVELS];
+};
+
+// contourspan is a run of points between two kept ones, still to be simplified
+typedef struct {
+	int a, b;
+	VGfloat limit;						   // rank of the point that split it off
+} contourspan;
+
+// contourdist is the distance of point i from the line through points a and b
+static VGfloat contourdist(const VGfloat * xy, int i, int a, int b) {
+	VGfloat dx = xy[2 * b] - xy[2 * a], dy = xy[2 * b + 1] - xy[2 * a + 1];
+	VGfloat px = xy[2 * i] - xy[2 * a], py = xy[2 * i + 1] - xy[2 * a + 1];
+	VGfloat len = sqrtf((dx * dx) + (dy * dy));
+	return len > 0 ? fabsf((dx * py) - (dy * px)) / len : sqrtf((px * px) + (py * py));
+}
+
+// contourrank ranks every point. The ends and the point farthest from the start
+// are always kept; a point splitting a span is ranked no higher than the point
+// that split off the span, so every tolerance keeps a nested set of points.
+static void contourrank(struct contour *c) {
+	contourspan *stack = malloc((c->n + 2) * sizeof(contourspan));
+	int far = 0, top = 0;
+	VGfloat d, best = 0;
+
+	for (int i = 0; i < c->n; i++) {
+		c->rank[i] = 0;
+		if ((d = contourdist(c->xy, i, 0, 0)) > best) {
+			far = i, best = d;
+		}
+	}
+	c->rank[0] = c->rank[far] = c->rank[c->n - 1] = FLT_MAX;
+	stack[top++] = (contourspan) { 0, far, FLT_MAX };
+	stack[top++] = (contourspan) { far, c->n - 1, FLT_MAX };
+	while (top > 0) {
+		contourspan s = stack[--top];
+		int split = -1;
+		best = -1;
+		for (int i = s.a + 1; i < s.b; i++) {
+			if ((d = contourdist(c->xy, i, s.a, s.b)) > best) {
+				split = i, best = d;
+			}
+		}
+		if (split < 0) {
+			continue;
+		}
+		c->rank[split] = fminf(best, s.limit);
+		stack[top++] = (contourspan) { s.a, split, c->rank[split] };
+		stack[top++] = (contourspan) { split, s.b, c->rank[split] };
+	}
+	free(stack);
+}
+
+// contourlevel picks the coarsest level whose error stays within CONTOURERROR
+// pixels at the current transform's larger scale
+static int contourlevel(struct contour *c) {
+	const VGfloat *m = matrixstack[matrixtop];
+	VGfloat scale = fmaxf(hypotf(m[0], m[1]), hypotf(m[3], m[4]));
+	if (scale <= 0 || c->extent <= 0) {
+		return CONTOURLEVELS - 1;
+	}
+	VGfloat k = floorf(CONTOURLEVELS + log2f(CONTOURERROR / (scale * c->extent)));
+	return k < 0 ? 0 : k > CONTOURLEVELS - 1 ? CONTOURLEVELS - 1 : (int)k;
+}
+
+// contourpath makes the path of one level
+static VGPath contourpath(struct contour *c, int k) {
+	VGfloat tolerance = k == 0 ? -1.0f : ldexpf(c->extent, k - CONTOURLEVELS);
+	int n = 0;
+
+	batchreserve(c->n, c->n * 2);
+	for (int i = 0; i < c->n; i++) {
+		if (c->rank[i] > tolerance) {
+			batchbuf.segs[n] = n == 0 ? VG_MOVE_TO_ABS : VG_LINE_TO_ABS;
+			batchbuf.coords[2 * n] = c->xy[2 * i];
+			batchbuf.coords[2 * n + 1] = c->xy[2 * i + 1];
+			n++;
+		}
+	}
+	batchbuf.nseg = n;
+	batchbuf.ncoord = n * 2;
+	return batchpath();
+}
+
+// NewContour keeps n points for drawing at the detail the scale can show
+Contour NewContour(VGfloat * x, VGfloat * y, VGint n) {
+	struct contour *c = calloc(1, sizeof(struct contour));
+	VGfloat b[4] = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	c->n = n > 0 ? n : 0;
+	c->xy = malloc((c->n > 0 ? c->n : 1) * 2 * sizeof(VGfloat));
+	c->rank = malloc((c->n > 0 ? c->n : 1) * sizeof(VGfloat));
+	interleave(x, y, c->n, c->xy);
+	for (int i = 0; i < c->n; i++) {
+		b[0] = fminf(b[0], x[i]);
+		b[1] = fminf(b[1], y[i]);
+		b[2] = fmaxf(b[2], x[i]);
+		b[3] = fmaxf(b[3], y[i]);
+	}
+	if (c->n > 0) {
+		c->bbox[0] = b[0];
+		c->bbox[1] = b[1];
+		c->bbox[2] = b[2] - b[0];
+		c->bbox[3] = b[3] - b[1];
+		c->extent = fmaxf(c->bbox[2], c->bbox[3]);
+		contourrank(c);
+	}
+	for (int k = 0; k < CONTOURLEVELS; k++) {
+		c->level[k] = VG_INVALID_HANDLE;
+	}
+	return c;
+}
+
+// DrawContour draws a contour, filled like Polygon or stroked like Polyline as mode
+// (VG_FILL_PATH, VG_STROKE_PATH) says, with no more points than the scale can show
+void DrawContour(Contour c, VGbitfield mode) {
+	if (c->n == 0 || culled(c->bbox[0], c->bbox[1], c->bbox[2], c->bbox[3], strokepad(mode))) {
+		return;
+	}
+	int k = contourlevel(c);
+	if (c->level[k] == VG_INVALID_HANDLE) {
+		c->level[k] = contourpath(c, k);
+	}
+	placeshape(c->level[k], 1.0f, 1.0f, 0.0f, 0.0f, mode, 0);
+}
+
+// DeleteContour frees a contour and the paths made for it
+void DeleteContour(Contour c) {
+	if (c != NULL) {
+		for (int k = 0; k < CONTOURLEVELS; k++) {
+			if (c->level[k] != VG_INVALID_HANDLE) {
+				deferrelease(c->level[k]);
+				vgDestroyPath(c->level[k]);
+			}
+		}
+		free(c->xy);
+		free(c->rank);
+		free(c);
+	}
+}
@@ -24,7 +24,7 @@ extern void oglinit(STATE_T * state) {
 		EGL_GREEN_SIZE, 8,
 		EGL_BLUE_SIZE, 8,
 		EGL_ALPHA_SIZE, 8,
-		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT | EGL_PBUFFER_BIT,
 		EGL_NONE
 	};
 
@@ -44,6 +44,7 @@ extern void oglinit(STATE_T * state) {
 	// get an appropriate EGL frame buffer configuration
 	result = eglChooseConfig(state->display, attribute_list, &config, 1, &num_config);
 	assert(EGL_FALSE != result);
+	state->config = config;
 
 	// create an EGL rendering context
 	state->context = eglCreateContext(state->display, config, EGL_NO_CONTEXT, NULL);
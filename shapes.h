@@ -1,5 +1,59 @@
 #include <VG/openvg.h>
 #include <VG/vgu.h>
+
+// GlyphCacheStats holds the glyph cache counters
+typedef struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	unsigned long bytes;
+	int entries;
+} GlyphCacheStats;
+
+// StartupStats holds startup timings, in seconds from the start of init(),
+// and the progress of glyph prewarming
+typedef struct {
+	double init;						   // init() returned
+	double fontready;					   // the first font was usable
+	double firstframe;					   // End() presented the first frame
+	double prewarmed;					   // the last prewarm was handed over, 0 until then
+	int glyphs;						   // prewarmed glyphs handed over
+} StartupStats;
+
+// StateStats counts the VG state changes made and skipped as redundant in a frame,
+// the shapes deferred with the paint and stroke changes they needed before and
+// after grouping, and the draws made and culled as outside the view
+typedef struct {
+	unsigned long sets;
+	unsigned long skipped;
+	unsigned long deferred;
+	unsigned long inorder;
+	unsigned long reordered;
+	unsigned long drawn;
+	unsigned long culled;
+} StateStats;
+
+// Gradient is a gradient paint kept for filling many times
+typedef struct gradient *Gradient;
+
+// Path is a path kept for drawing many times, with coordinates that can change
+typedef struct path *Path;
+
+// Contour is a polygon or polyline with many points, drawn at the detail the scale can show
+typedef struct contour *Contour;
+
+// TextLayout is a string decoded and positioned once, for drawing many times
+typedef struct textlayout *TextLayout;
+
+// TextBlock is a paragraph of text wrapped to a width, for drawing many times
+typedef struct textblock *TextBlock;
+
+// TextView is a scrolling view of a large text, drawn a screenful of lines at a time
+typedef struct textview *TextView;
+
+// Ticker is a line of text rendered once into an image and scrolled by moving pixels
+typedef struct ticker *Ticker;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -7,20 +61,80 @@ extern "C" {
 	extern void Rotate(VGfloat);
 	extern void Shear(VGfloat, VGfloat);
 	extern void Scale(VGfloat, VGfloat);
+	extern void Push();
+	extern void Pop();
 	extern void Text(VGfloat, VGfloat, char *, int);
 	extern void TextMid(VGfloat, VGfloat, char *, int);
 	extern void TextEnd(VGfloat, VGfloat, char *, int);
 	extern VGfloat TextWidth(char *, int);
+	extern void TextN(VGfloat, VGfloat, char *, int, int);
+	extern void TextMidN(VGfloat, VGfloat, char *, int, int);
+	extern void TextEndN(VGfloat, VGfloat, char *, int, int);
+	extern VGfloat TextWidthN(char *, int, int);
+	extern void TextBBox(char *, int, VGfloat[4]);
+	extern void TextKerning(int);
+	extern void TextMerge(int);
+	extern void TextAtlas(int, int);
+	extern void TextRaster(VGfloat, VGfloat, char *, int);
+	extern TextLayout NewTextLayout(char *);
+	extern void DeleteTextLayout(TextLayout);
+	extern void TextLayoutDraw(TextLayout, VGfloat, VGfloat, int);
+	extern void TextLayoutMid(TextLayout, VGfloat, VGfloat, int);
+	extern void TextLayoutEnd(TextLayout, VGfloat, VGfloat, int);
+	extern VGfloat TextLayoutWidth(TextLayout, int);
+	extern void TextLayoutBBox(TextLayout, int, VGfloat[4]);
+	extern VGfloat TextLineHeight(int);
+	extern int TextFit(char *, VGfloat, VGfloat);
+	extern TextBlock NewTextBlock(char *, VGfloat, int);
+	extern void TextBlockUpdate(TextBlock, char *);
+	extern void TextBlockResize(TextBlock, VGfloat, int);
+	extern void DeleteTextBlock(TextBlock);
+	extern int TextBlockLines(TextBlock);
+	extern void TextBlockDraw(TextBlock, VGfloat, VGfloat, VGfloat);
+	extern void TextBlockMid(TextBlock, VGfloat, VGfloat, VGfloat);
+	extern void TextBlockEnd(TextBlock, VGfloat, VGfloat, VGfloat);
+	extern TextView NewTextView(VGfloat, VGfloat, int);
+	extern TextView OpenTextView(char *, VGfloat, VGfloat, int);
+	extern int TextViewReload(TextView);
+	extern void TextViewAppend(TextView, char *, int);
+	extern int TextViewLines(TextView);
+	extern void TextViewScroll(TextView, VGfloat);
+	extern void TextViewTail(TextView);
+	extern void TextViewDraw(TextView, VGfloat, VGfloat);
+	extern void DeleteTextView(TextView);
+	extern Ticker NewTicker(char *, int);
+	extern void TickerText(Ticker, char *);
+	extern VGfloat TickerWidth(Ticker);
+	extern void TickerDraw(Ticker, VGfloat, VGfloat, VGfloat, VGfloat);
+	extern void DeleteTicker(Ticker);
+	extern void GlyphCacheLimit(int, unsigned long);
+	extern void GlyphCacheFlush();
+	extern void GlyphCacheInfo(GlyphCacheStats *);
+	extern int LoadFont(char *);
+	extern int LoadFontBundle(char *);
+	extern int LoadFontAsync(char *);
+	extern void FontPrewarm(int, char *);
+	extern void FontPrewarmRange(int, unsigned int, unsigned int);
+	extern void StartupInfo(StartupStats *);
+	extern int SetFont(int);
+	extern void FontFallback(int, int);
 	extern void Cbezier(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Qbezier(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Polygon(VGfloat *, VGfloat *, VGint);
 	extern void Polyline(VGfloat *, VGfloat *, VGint);
+	extern void PolylineSeries(VGfloat *, VGfloat *, VGint, VGint);
 	extern void Rect(VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Line(VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Roundrect(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Ellipse(VGfloat, VGfloat, VGfloat, VGfloat);
 	extern void Circle(VGfloat, VGfloat, VGfloat);
 	extern void Arc(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
+	extern void Circles(VGfloat *, VGfloat *, VGfloat *, VGint);
+	extern void Rects(VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGint);
+	extern void Lines(VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGint);
+	extern void CirclesColor(VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGint);
+	extern void RectsColor(VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGint);
+	extern void LinesColor(VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGfloat *, VGint);
 	extern void Image(VGfloat, VGfloat, int, int, char *);
 	extern void Start(int, int);
 	extern void End();
@@ -38,8 +152,35 @@ extern "C" {
 	extern void RGB(unsigned int, unsigned int, unsigned int, VGfloat[4]);
 	extern void FillLinearGradient(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat *, int);
 	extern void FillRadialGradient(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat *, int);
+	extern Gradient NewLinearGradient(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat *, int);
+	extern Gradient NewRadialGradient(VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat *, int);
+	extern void LinearGradientPoints(Gradient, VGfloat, VGfloat, VGfloat, VGfloat);
+	extern void RadialGradientPoints(Gradient, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
+	extern void GradientStops(Gradient, VGfloat *, int);
+	extern void GradientSpread(Gradient, VGColorRampSpreadMode);
+	extern void FillGradient(Gradient);
+	extern void DeleteGradient(Gradient);
+	extern Path NewPath();
+	extern void PathMoveTo(Path, VGfloat, VGfloat);
+	extern void PathLineTo(Path, VGfloat, VGfloat);
+	extern void PathQuadTo(Path, VGfloat, VGfloat, VGfloat, VGfloat);
+	extern void PathCubicTo(Path, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat);
+	extern void PathArcTo(Path, VGfloat, VGfloat, VGfloat, VGfloat, VGfloat, int, int);
+	extern void PathClose(Path);
+	extern int PathSegments(Path);
+	extern void PathCoords(Path, int, int, VGfloat *);
+	extern int PathInterpolate(Path, Path, Path, VGfloat);
+	extern void DrawPath(Path, VGbitfield);
+	extern void DrawInstances(Path, VGfloat *, VGfloat *, VGint, VGbitfield);
+	extern void DeletePath(Path);
+	extern Contour NewContour(VGfloat *, VGfloat *, VGint);
+	extern void DrawContour(Contour, VGbitfield);
+	extern void DeleteContour(Contour);
 	extern void ClipRect(VGint x, VGint y, VGint w, VGint h);
 	extern void ClipEnd();
+	extern void StateInfo(StateStats *);
+	extern void ResetState();
+	extern void DeferDraw(int);
 	extern void makeimage(VGfloat, VGfloat, int, int, VGubyte *);
 	extern void saveterm();
 	extern void restoreterm();
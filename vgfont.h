@@ -0,0 +1,36 @@
+//
+// vgfont: layout of precompiled font outline bundles (.vgf)
+//
+// A bundle is written by fontutil/font2vgf and mapped read-only by libshapes.
+// All values are native-endian; coordinates, advances and metrics use the
+// glyph path encoding of libshapes: VG_PATH_DATATYPE_S_32 with a scale of
+// 1/65536, so a glyph drawn under a scale of pointsize has that size.
+//
+#include <stdint.h>
+
+#define VGF_MAGIC	0x31464756			   // "VGF1"
+#define VGF_VERSION	1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nglyphs;					   // entries in the glyph table
+	uint32_t nsegs;						   // bytes of segment data
+	uint32_t ncoords;					   // entries of coordinate data
+	int32_t ascender;
+	int32_t descender;
+	int32_t height;						   // baseline to baseline distance
+	uint32_t glyphoffset;					   // file offsets of the three tables
+	uint32_t segoffset;
+	uint32_t coordoffset;
+} vgfheader;
+
+// vgfglyph describes one glyph; the table is sorted by codepoint, and the
+// font's missing glyph, when present, is stored under codepoint 0
+typedef struct {
+	uint32_t codepoint;
+	int32_t advance;
+	int32_t minx, miny, maxx, maxy;				   // outline bounding box
+	uint32_t seg, nseg;					   // range in the segment table
+	uint32_t coord, ncoord;					   // range in the coordinate table
+} vgfglyph;